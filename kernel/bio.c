@@ -7,6 +7,7 @@
 //
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
+// * To overwrite all of a block, call bnew, which skips the read.
 // * After changing buffer data, call bwrite to write it to disk.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
@@ -268,6 +269,18 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buf for the indicated block without reading it,
+// for a caller that overwrites all of b->data and then sets
+// b->valid. Until then the data are whatever the cache held,
+// which is garbage if b->valid is 0; a caller that gives up
+// half way leaves b->valid alone, so the next bread reads the
+// block from disk.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  return bget(dev, blockno);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
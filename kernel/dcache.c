@@ -0,0 +1,180 @@
+// Directory entry cache.
+//
+// Remembers what dirlookup_vn() found for a (directory, name)
+// pair: the inode number, or 0 for a name that is not there.
+// namex_vn() consults it before reading the directory, so
+// resolving a hot path needs no directory I/O.
+//
+// Entries for a directory are only looked up, added or removed
+// while the caller holds that directory's inode lock, the same
+// lock that serializes changes to the directory itself, so the
+// cache cannot disagree with the disk:
+// * dirlink_vn() enters the new name,
+// * rmdir_vn() forgets the removed name,
+// * iput() purges every entry of a directory it frees.
+//
+// Names longer than DIRSIZ are never cached.
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "fs.h"
+
+struct dentry {
+  uint dev;
+  uint dir;             // inode number of the directory
+  uint inum;            // 0 for a negative entry
+  uint8 len;
+  char name[DIRSIZ];
+  struct dentry *hnext; // hash chain
+  struct dentry *prev;  // LRU list, prev is more recently used
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry ent[NDENTRY];
+  struct dentry *hash[NDHASH];
+  struct dentry lru;    // lru.next is most recently used
+} dcache;
+
+static uint
+dhash(uint dev, uint dir, char *name, uint8 len)
+{
+  uint h = dev * 31 + dir;
+  int i;
+
+  for(i = 0; i < len; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % NDHASH;
+}
+
+void
+dcacheinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.lru.prev = dcache.lru.next = &dcache.lru;
+  for(d = dcache.ent; d < dcache.ent + NDENTRY; d++){
+    d->next = dcache.lru.next;
+    d->prev = &dcache.lru;
+    dcache.lru.next->prev = d;
+    dcache.lru.next = d;
+  }
+}
+
+// Move d to the front of the LRU list.
+static void
+dtouch(struct dentry *d)
+{
+  d->prev->next = d->next;
+  d->next->prev = d->prev;
+  d->next = dcache.lru.next;
+  d->prev = &dcache.lru;
+  dcache.lru.next->prev = d;
+  dcache.lru.next = d;
+}
+
+static void
+dunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  if(d->len == 0)
+    return;     // not in use
+  for(pp = &dcache.hash[dhash(d->dev, d->dir, d->name, d->len)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == d){
+      *pp = d->hnext;
+      break;
+    }
+  }
+  d->len = 0;
+}
+
+// Caller must hold dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dir, char *name, uint8 len)
+{
+  struct dentry *d;
+
+  for(d = dcache.hash[dhash(dev, dir, name, len)]; d; d = d->hnext)
+    if(d->dev == dev && d->dir == dir && d->len == len &&
+       strncmp(d->name, name, len) == 0)
+      return d;
+  return 0;
+}
+
+// Look up name in directory dir. On a hit, set *inum (0 if the
+// name is known to be absent) and return 1; on a miss return 0.
+int
+dcache_lookup(uint dev, uint dir, char *name, uint8 len, uint *inum)
+{
+  struct dentry *d;
+
+  if(len == 0 || len > DIRSIZ)
+    return 0;
+  acquire(&dcache.lock);
+  if((d = dfind(dev, dir, name, len)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  dtouch(d);
+  *inum = d->inum;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in directory dir is inode inum (0 for none),
+// recycling the least recently used entry.
+void
+dcache_enter(uint dev, uint dir, char *name, uint8 len, uint inum)
+{
+  struct dentry *d;
+
+  if(len == 0 || len > DIRSIZ)
+    return;
+  acquire(&dcache.lock);
+  if((d = dfind(dev, dir, name, len)) == 0){
+    d = dcache.lru.prev;
+    dunhash(d);
+    d->dev = dev;
+    d->dir = dir;
+    d->len = len;
+    memmove(d->name, name, len);
+    d->hnext = dcache.hash[dhash(dev, dir, name, len)];
+    dcache.hash[dhash(dev, dir, name, len)] = d;
+  }
+  d->inum = inum;
+  dtouch(d);
+  release(&dcache.lock);
+}
+
+// Forget name in directory dir.
+void
+dcache_forget(uint dev, uint dir, char *name, uint8 len)
+{
+  struct dentry *d;
+
+  if(len == 0 || len > DIRSIZ)
+    return;
+  acquire(&dcache.lock);
+  if((d = dfind(dev, dir, name, len)) != 0)
+    dunhash(d);
+  release(&dcache.lock);
+}
+
+// Forget every entry of directory dir.
+void
+dcache_purge(uint dev, uint dir)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.ent; d < dcache.ent + NDENTRY; d++)
+    if(d->len && d->dev == dev && d->dir == dir)
+      dunhash(d);
+  release(&dcache.lock);
+}
@@ -2,6 +2,8 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct diskstat;
+struct logstat;
 struct pipe;
 struct proc;
 struct spinlock;
@@ -12,6 +14,7 @@ struct superblock;
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bnew(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
@@ -22,6 +25,13 @@ void            consoleinit(void);
 void            consoleintr(int);
 void            consputc(int);
 
+// dcache.c
+void            dcacheinit(void);
+int             dcache_lookup(uint, uint, char*, uint8, uint*);
+void            dcache_enter(uint, uint, char*, uint8, uint);
+void            dcache_forget(uint, uint, char*, uint8);
+void            dcache_purge(uint, uint);
+
 // exec.c
 int             exec(char*, char**);
 
@@ -33,9 +43,14 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filepread(struct file*, uint64, int n, uint);
+int             filepwrite(struct file*, uint64, int n, uint);
+int             fileseek(struct file*, int, int);
+int             filegetdents(struct file*, uint64, int, int);
 
 // fs.c
 void            fsinit(int);
+void            bitmap_commit(void);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
@@ -53,9 +68,26 @@ int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
-
-int             dirlink_vn(struct inode*, char*, uint8, uint);
+int             ireserve(struct inode*, uint, uint);
+void            irelease(struct inode*);
+int             atimeswitch(int);
+int             isetflags(struct inode*, uint, uint);
+int             iseekdata(struct inode*, uint, int);
+int             cextend(struct inode*, uint);
+int             ifallocate(struct inode*, uint, uint, int);
+void            orphand(void);
+
+int             dirlink_vn(struct inode*, char*, uint8, uint, uint8);
 struct inode*   dirlookup_vn(struct inode*, char *, uint8 , uint*, uint*);
+struct inode*   dirlookup_dx(struct inode*, char*, uint8, uint*);
+int             dirlink_dx(struct inode*, char*, uint8, uint, uint8);
+int             rmdir_dx(struct inode*, uint);
+int             dirempty(struct inode*);
+int             dirnext(struct inode*, uint*, char*, uint8*, uint*, uint8*);
+int             dirread(struct inode*, uint*, char*, int, int);
+void            nidx_add(uint, uint, char*, uint8, uint);
+void            nidx_del(uint, uint, char*, uint8, uint);
+int             nidx_search(char*, uint8, char*, int);
 int             rmdir_vn(struct inode*, uint, uint);
 
 struct inode*   nameiparent_vn(char *path, char *name);
@@ -73,13 +105,21 @@ void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
 
+// lz.c
+int             lz_compress(const uchar*, int, uchar*, int);
+int             lz_decompress(const uchar*, int, uchar*, int);
+
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
+void            log_defer(uint);
 void            begin_op(void);
 void            end_op(void);
 void            switchs(int lstat);
+void            log_sync(void);
+void            logflush(void);
 int             logstate_get(void);
+void            logstat_get(struct logstat*, int);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
@@ -109,6 +149,7 @@ void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+void            kthread(void (*)(void), char*);
 int             wait(uint64);
 void            wakeup(void*);
 void            yield(void);
@@ -191,7 +232,9 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
-void            virtio_disk_intr(void);
+void            virtio_disk_intr(int);
+int             virtio_disk_present(uint);
+void            virtio_disk_stat(struct diskstat*, int);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
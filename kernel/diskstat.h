@@ -0,0 +1,10 @@
+// Disk transfer counts, filled in by the diskstat() system call.
+// Both the kernel and user programs use this header file.
+// Index 0 is the root disk, index 1 the external journal disk.
+
+#define NDISKSTAT 2
+
+struct diskstat {
+  uint64 nread[NDISKSTAT];        // blocks read from each disk
+  uint64 nwrite[NDISKSTAT];       // blocks written to each disk
+};
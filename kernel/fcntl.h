@@ -3,3 +3,12 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
+#define O_SYNC    0x800
+
+#define SEEK_SET  0
+#define SEEK_CUR  1
+#define SEEK_END  2
+#define SEEK_DATA 3   // next data at or after the offset
+#define SEEK_HOLE 4   // next hole at or after the offset
+
+#define FALLOC_FL_KEEP_SIZE 0x01  // fallocate() leaves the size alone
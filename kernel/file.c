@@ -12,6 +12,7 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "fcntl.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -101,15 +102,18 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
-// Read from file f.
+// Read from file f at *off, advancing *off past the bytes read.
+// off is 0 to use the file's own offset, which only FD_INODE has.
 // addr is a user virtual address.
-int
-fileread(struct file *f, uint64 addr, int n)
+static int
+readoff(struct file *f, uint64 addr, int n, uint *off)
 {
   int r = 0;
 
   if(f->readable == 0)
     return -1;
+  if(off && f->type != FD_INODE)
+    return -1;
 
   if(f->type == FD_PIPE){
     r = piperead(f->pipe, addr, n);
@@ -119,8 +123,10 @@ fileread(struct file *f, uint64 addr, int n)
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
+    if(off == 0)
+      off = &f->off;
+    if((r = readi(f->ip, 1, addr, *off, n)) > 0)
+      *off += r;
     iunlock(f->ip);
   } else {
     panic("fileread");
@@ -129,15 +135,16 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
-// Write to file f.
-// addr is a user virtual address.
-int
-filewrite(struct file *f, uint64 addr, int n)
+// Write to file f at *off, like readoff().
+static int
+writeoff(struct file *f, uint64 addr, int n, uint *off)
 {
   int r, ret = 0;
 
   if(f->writable == 0)
     return -1;
+  if(off && f->type != FD_INODE)
+    return -1;
 
   if(f->type == FD_PIPE){
     ret = pipewrite(f->pipe, addr, n);
@@ -154,6 +161,8 @@ filewrite(struct file *f, uint64 addr, int n)
     // might be writing a device like the console.
     int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
     int i = 0;
+    if(off == 0)
+      off = &f->off;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
@@ -161,8 +170,23 @@ filewrite(struct file *f, uint64 addr, int n)
 
       begin_op();
       ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
+      if(cextend(f->ip, *off) > 0){
+        // padding the old last cluster took this transaction
+        iunlock(f->ip);
+        end_op();
+        continue;
+      }
+      // compressed files commit a cluster per writei(),
+      // so keep each transaction within one cluster.
+      if((f->ip->iflags & COMPR_FL) && n1 > CSIZE - *off % CSIZE)
+        n1 = CSIZE - *off % CSIZE;
+      // the window's bitmap update commits with the block
+      // pointers that use it, and its unused part is freed
+      // in the same transaction.
+      ireserve(f->ip, *off, n1);
+      if ((r = writei(f->ip, 1, addr + i, *off, n1)) > 0)
+        *off += r;
+      irelease(f->ip);
       iunlock(f->ip);
       end_op();
 
@@ -173,6 +197,8 @@ filewrite(struct file *f, uint64 addr, int n)
       i += r;
     }
     ret = (i == n ? n : -1);
+    if(i > 0 && (f->sync || (f->ip->iflags & SYNC_FL)))
+      log_sync();
   } else {
     panic("filewrite");
   }
@@ -180,3 +206,100 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Read from file f.
+// addr is a user virtual address.
+int
+fileread(struct file *f, uint64 addr, int n)
+{
+  return readoff(f, addr, n, 0);
+}
+
+// Write to file f.
+// addr is a user virtual address.
+int
+filewrite(struct file *f, uint64 addr, int n)
+{
+  return writeoff(f, addr, n, 0);
+}
+
+// Read from file f at offset off, leaving f->off alone.
+int
+filepread(struct file *f, uint64 addr, int n, uint off)
+{
+  return readoff(f, addr, n, &off);
+}
+
+// Write to file f at offset off, leaving f->off alone.
+int
+filepwrite(struct file *f, uint64 addr, int n, uint off)
+{
+  return writeoff(f, addr, n, &off);
+}
+
+// Set the offset of file f relative to whence (fcntl.h SEEK_*).
+// SEEK_DATA and SEEK_HOLE move to the next data or hole at or
+// after off. Returns the new offset.
+int
+fileseek(struct file *f, int off, int whence)
+{
+  int base;
+
+  if(f->type != FD_INODE)
+    return -1;
+  if(whence == SEEK_SET){
+    base = 0;
+  } else if(whence == SEEK_CUR){
+    base = f->off;
+  } else if(whence == SEEK_END){
+    ilock(f->ip);
+    base = f->ip->size;
+    iunlock(f->ip);
+  } else if(whence == SEEK_DATA || whence == SEEK_HOLE){
+    if(off < 0)
+      return -1;
+    ilock(f->ip);
+    base = iseekdata(f->ip, off, whence == SEEK_HOLE);
+    iunlock(f->ip);
+    if(base < 0)
+      return -1;
+    off = 0;
+  } else {
+    return -1;
+  }
+  if(base + off < 0)
+    return -1;
+  f->off = base + off;
+  return f->off;
+}
+
+// Read the directory entries of f from its offset on into user
+// buffer addr as struct dirent_plus records, as many as fit in n
+// bytes (at most a page), and advance the offset past them.
+// flags is DENT_STAT to fill in each entry's type and size.
+// Returns the bytes read, 0 at the end of the directory.
+int
+filegetdents(struct file *f, uint64 addr, int n, int flags)
+{
+  struct proc *p = myproc();
+  char *buf;
+  int r;
+
+  if(f->type != FD_INODE || f->readable == 0 || n <= 0)
+    return -1;
+  if(n > PGSIZE)
+    n = PGSIZE;
+  if((buf = kalloc()) == 0)
+    return -1;
+  ilock(f->ip);
+  if(!ISDIR(f->ip->type)){
+    iunlock(f->ip);
+    kfree(buf);
+    return -1;
+  }
+  r = dirread(f->ip, &f->off, buf, n, flags & DENT_STAT);
+  iunlock(f->ip);
+  if(r > 0 && copyout(p->pagetable, addr, buf, r) < 0)
+    r = -1;
+  kfree(buf);
+  return r;
+}
@@ -3,6 +3,7 @@ struct file {
   int ref; // reference count
   char readable;
   char writable;
+  char sync;         // O_SYNC: write() returns once on disk
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
@@ -18,8 +19,21 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext;  // hash chain
+  struct inode *lprev;  // LRU list of unreferenced inodes
+  struct inode *lnext;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  int dirty;          // I_DIRTY_TIME: timestamps newer than on disk
+  uint rsv_next;      // allocation window: next block to hand out
+  uint rsv_end;       // allocation window: one past its last block
+  uint map_lbn;       // bmap run cache: blocks map_lbn ..
+  uint map_pbn;       //   map_lbn+map_len-1 are at map_pbn ..
+  uint map_len;
+  uint map_ind;       // last leaf indirect block bmap used, or 0
+  uint map_indlbn;    // first file block that map_ind maps
+  char *cbuf;         // COMPR_FL staging page, or 0
+  int ccl;            // cluster staged in cbuf, or -1
 
   short type;           // File type
   short major;          // Major device number (T_DEVICE only)
@@ -37,6 +51,12 @@ struct inode {
   uint osd_2[7];          // OS dependant structure in EXT, be blank here
 };
 
+#define I_DIRTY_TIME 0x1
+
+// Held across rename(), so that no directory changes parent
+// while it checks that a directory is not moved below itself.
+extern struct sleeplock renamelock;
+
 // map major device number to device functions.
 struct devsw {
   int (*read)(int, uint64, int);
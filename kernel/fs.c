@@ -26,6 +26,39 @@
 // only one device
 struct superblock sb; 
 
+// In-memory copies of the free bit map and the inode map, loaded
+// at mount, which allocation searches and changes a 64-bit word at
+// a time without reading bitmap blocks. A changed bitmap block is
+// entered in the log by number only, and bitmap_commit() copies it
+// into the cache when the transaction commits; with logging off it
+// is written at once.
+//
+// Also a summary of the free bit map: the number of free blocks
+// covered by each bitmap block, and a next-fit cursor where the
+// previous allocation left off. balloc() skips full bitmap blocks.
+#define NBITMAP (FSSIZE/BPB + 1)
+#define BMPP    (PGSIZE/BSIZE)   // bitmap blocks per page
+#define NBMPAGE ((NBITMAP + BMPP - 1) / BMPP)
+
+struct bmcopy {
+  uint start;             // disk block of the first bitmap block
+  int n;                  // bitmap blocks
+  uchar *page[NBMPAGE];   // BMPP blocks each
+  char dirty[NBITMAP];    // changed in the open transaction
+};
+
+struct {
+  struct spinlock lock;   // protects everything, bm.page and im.page too
+  uint dev;
+  struct bmcopy bm;       // free bit map
+  struct bmcopy im;       // inode map, if sb.imapstart
+  int nbitmap;            // bitmap blocks in use
+  uint nfree[NBITMAP];    // free blocks per bitmap block
+  uint cursor;            // block number to resume searching at
+} freemap;
+
+static void freemap_init(int dev);
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
@@ -44,6 +77,19 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  readsb(dev, &sb);   // recovery may have replayed a newer one
+  freemap_init(dev);
+}
+
+// Write a modified metadata block: through the log,
+// or straight to disk when logging is switched off.
+static void
+mwrite(struct buf *bp)
+{
+  if(logstate_get() != 0)
+    log_write(bp);
+  else
+    bwrite(bp);
 }
 
 // Zero a block.
@@ -52,64 +98,382 @@ bzero(int dev, int bno)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
+  bp = bnew(dev, bno);
   memset(bp->data, 0, BSIZE);
-  if(logstate_get() != 0)
-  log_write(bp);
-  else 
-  bwrite(bp);
-  //bwrite(bp);//log_write(bp);
+  bp->valid = 1;
+  mwrite(bp);
   brelse(bp);
 }
 
 // Blocks.
 
-// Allocate a zeroed disk block.
-static uint
-balloc(uint dev)
+// Bitmap words scanned at a time.
+#define BPW   64
+#define WPB   (BPB/BPW)
+
+// Index of the lowest clear bit in w, which must not be all ones.
+static int
+firstzero(uint64 w)
+{
+  int i;
+
+  w = ~w;
+  for(i = 0; (w & 0xff) == 0; i += 8)
+    w >>= 8;
+  for(; (w & 1) == 0; i++)
+    w >>= 1;
+  return i;
+}
+
+// Number of set bits in w.
+static int
+nbits(uint64 w)
+{
+  int n;
+
+  for(n = 0; w; n++)
+    w &= w - 1;
+  return n;
+}
+
+// Bitmap block i of c.
+static uint64*
+bmword(struct bmcopy *c, int i)
+{
+  return (uint64*)(c->page[i / BMPP] + (i % BMPP) * BSIZE);
+}
+
+// Load the n bitmap blocks from start on into c.
+static void
+bmload(int dev, struct bmcopy *c, uint start, int n)
 {
-  int b, bi, m;
   struct buf *bp;
+  int i;
+
+  c->start = start;
+  c->n = n;
+  for(i = 0; i < n; i += BMPP)
+    if((c->page[i / BMPP] = kalloc()) == 0)
+      panic("bmload: kalloc");
+  for(i = 0; i < n; i++){
+    bp = bread(dev, start + i);
+    memmove(bmword(c, i), bp->data, BSIZE);
+    c->dirty[i] = 0;
+    brelse(bp);
+  }
+}
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        if(logstate_get() != 0)
-        log_write(bp);
-        else 
-        bwrite(bp);//log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
-    }
+// Bitmap block i of c has changed: enter it in the transaction,
+// or write it now if logging is off.
+// Caller must not hold freemap.lock.
+static void
+bmwrite(struct bmcopy *c, int i)
+{
+  struct buf *bp;
+
+  if(logstate_get() != 0){
+    acquire(&freemap.lock);
+    c->dirty[i] = 1;
+    release(&freemap.lock);
+    log_defer(c->start + i);
+    return;
+  }
+  bp = bnew(freemap.dev, c->start + i);
+  acquire(&freemap.lock);
+  memmove(bp->data, bmword(c, i), BSIZE);
+  release(&freemap.lock);
+  bp->valid = 1;
+  bwrite(bp);
+  brelse(bp);
+}
+
+static void
+bmcommit(struct bmcopy *c)
+{
+  struct buf *bp;
+  int i;
+
+  for(i = 0; i < c->n; i++){
+    if(!c->dirty[i])
+      continue;
+    bp = bnew(freemap.dev, c->start + i);
+    acquire(&freemap.lock);
+    memmove(bp->data, bmword(c, i), BSIZE);
+    c->dirty[i] = 0;
+    release(&freemap.lock);
+    bp->valid = 1;
+    bpin(bp);   // as log_write() would have
     brelse(bp);
   }
+}
+
+// Copy the bitmap blocks changed in the committing transaction
+// into the cache, for write_log() to find there.
+// Called by commit(), while no FS system call is active.
+void
+bitmap_commit(void)
+{
+  bmcommit(&freemap.bm);
+  if(sb.imapstart)
+    bmcommit(&freemap.im);
+}
+
+// Load the bitmaps and count the free blocks under each bitmap block.
+static void
+freemap_init(int dev)
+{
+  uint64 *w;
+  int i, k;
+  uint b, nfree;
+
+  initlock(&freemap.lock, "freemap");
+  freemap.dev = dev;
+  freemap.nbitmap = (sb.size + BPB - 1) / BPB;
+  if(freemap.nbitmap > NBITMAP || sb.ninodes / BPB + 1 > NBITMAP)
+    panic("freemap_init: file system too big");
+  bmload(dev, &freemap.bm, sb.bmapstart, freemap.nbitmap);
+  if(sb.imapstart)
+    bmload(dev, &freemap.im, sb.imapstart, sb.ninodes / BPB + 1);
+  for(i = 0; i < freemap.nbitmap; i++){
+    w = bmword(&freemap.bm, i);
+    nfree = 0;
+    for(k = 0; k < WPB; k++){
+      b = i*BPB + k*BPW;
+      if(b >= sb.size)
+        break;
+      if(b + BPW <= sb.size)
+        nfree += BPW - nbits(w[k]);
+      else
+        nfree += (sb.size - b) - nbits(w[k] & ((1UL << (sb.size - b)) - 1));
+    }
+    freemap.nfree[i] = nfree;
+  }
+  freemap.cursor = 0;
+}
+
+// Bit bi of bitmap block w.
+#define BMTEST(w, bi) ((w)[(bi)/BPW] & (1UL << ((bi) % BPW)))
+#define BMSET(w, bi)  ((w)[(bi)/BPW] |= 1UL << ((bi) % BPW))
+#define BMCLR(w, bi)  ((w)[(bi)/BPW] &= ~(1UL << ((bi) % BPW)))
+
+// Look for a free block in words [k0, k1) of bitmap block i,
+// mark it in use and return it, or 0 if there is none.
+static uint
+bscan(uint dev, int i, int k0, int k1)
+{
+  uint64 *w;
+  int k, bi;
+  uint b;
+
+  acquire(&freemap.lock);
+  w = bmword(&freemap.bm, i);
+  for(k = k0; k < k1; k++){
+    if(w[k] == ~0UL)  // all 64 blocks in use
+      continue;
+    bi = k*BPW + firstzero(w[k]);
+    b = i*BPB + bi;
+    if(b >= sb.size)
+      break;
+    BMSET(w, bi);  // Mark block in use.
+    freemap.nfree[i]--;
+    freemap.cursor = b + 1;
+    release(&freemap.lock);
+    bmwrite(&freemap.bm, i);
+    return b;
+  }
+  release(&freemap.lock);
+  return 0;
+}
+
+// Allocate block goal if it is free, else return 0.
+static uint
+bgoal(uint dev, uint goal)
+{
+  uint64 *w;
+  int bi;
+
+  if(goal < sb.bmapstart + freemap.nbitmap || goal >= sb.size)
+    return 0;
+  acquire(&freemap.lock);
+  w = bmword(&freemap.bm, goal / BPB);
+  bi = goal % BPB;
+  if(BMTEST(w, bi)){
+    release(&freemap.lock);
+    return 0;
+  }
+  BMSET(w, bi);  // Mark block in use.
+  freemap.nfree[goal / BPB]--;
+  if(freemap.cursor <= goal)
+    freemap.cursor = goal + 1;
+  release(&freemap.lock);
+  bmwrite(&freemap.bm, goal / BPB);
+  return goal;
+}
+
+// Allocate a zeroed disk block, block goal if that is free
+// (pass 0 for no preference).
+// Otherwise next fit: start where the last allocation stopped,
+// skip bitmap blocks the summary says are full, and wrap around
+// to rescan the start of the first block last.
+static uint
+balloc(uint dev, uint goal)
+{
+  int n, i, i0, k0;
+  uint b, cursor;
+
+  if(goal != 0 && (b = bgoal(dev, goal)) != 0){
+    bzero(dev, b);
+    return b;
+  }
+
+  acquire(&freemap.lock);
+  cursor = freemap.cursor;
+  release(&freemap.lock);
+  if(cursor >= sb.size)
+    cursor = 0;
+  i0 = cursor / BPB;
+  k0 = (cursor % BPB) / BPW;
+
+  for(n = 0; n <= freemap.nbitmap; n++){
+    i = (i0 + n) % freemap.nbitmap;
+    if(freemap.nfree[i] == 0)
+      continue;
+    if(n == 0)
+      b = bscan(dev, i, k0, WPB);
+    else if(n == freemap.nbitmap)
+      b = bscan(dev, i, 0, k0 + 1);
+    else
+      b = bscan(dev, i, 0, WPB);
+    if(b != 0){
+      bzero(dev, b);
+      return b;
+    }
+  }
   panic("balloc: out of blocks");
 }
 
+// Find a run of want free blocks within one bitmap block:
+// at goal if possible, else the first after the next-fit
+// cursor, else the longest run seen. Sets *len to the run's
+// length and returns its first block, or 0 if none was found.
+// Nothing is marked in use.
+static uint
+brun(uint dev, uint goal, uint want, uint *len)
+{
+  uint64 *w;
+  uint b, start, run, best, bestlen, limit;
+  int n, i, i0, bi;
+
+  best = bestlen = 0;
+  acquire(&freemap.lock);
+  if(goal < sb.bmapstart + freemap.nbitmap || goal >= sb.size)
+    goal = freemap.cursor;
+  if(goal >= sb.size)
+    goal = 0;
+  i0 = goal / BPB;
+
+  for(n = 0; n < freemap.nbitmap; n++){
+    i = (i0 + n) % freemap.nbitmap;
+    if(freemap.nfree[i] == 0)
+      continue;
+    w = bmword(&freemap.bm, i);
+    limit = sb.size - i*BPB < BPB ? sb.size - i*BPB : BPB;
+    run = start = 0;
+    bi = n == 0 ? goal % BPB : 0;
+    while(bi < limit){
+      if(bi % BPW == 0 && bi + BPW <= limit && w[bi/BPW] == ~0UL){
+        run = 0;    // all 64 in use
+        bi += BPW;
+        continue;
+      }
+      if(bi % BPW == 0 && bi + BPW <= limit && w[bi/BPW] == 0 && run + BPW <= want){
+        if(run == 0)
+          start = bi;
+        run += BPW; // all 64 free
+        bi += BPW;
+      } else if(BMTEST(w, bi)){
+        run = 0;
+        bi++;
+      } else {
+        if(run == 0)
+          start = bi;
+        run++;
+        bi++;
+      }
+      if(run > bestlen){
+        best = i*BPB + start;
+        bestlen = run;
+      }
+      if(run == want)
+        break;
+    }
+    if(bestlen == want)
+      break;
+  }
+  release(&freemap.lock);
+  b = bestlen ? best : 0;
+  *len = bestlen;
+  return b;
+}
+
+// Mark in use the blocks of a run brun() found, start to
+// start+len, stopping at the first one someone else has taken
+// since. Returns how many it marked. Unlike balloc(), the blocks
+// are not zeroed.
+static uint
+btake(uint dev, uint start, uint len)
+{
+  uint64 *w;
+  uint n, bi;
+
+  acquire(&freemap.lock);
+  w = bmword(&freemap.bm, start / BPB);
+  for(n = 0; n < len; n++){
+    bi = (start + n) % BPB;
+    if(BMTEST(w, bi))
+      break;
+    BMSET(w, bi);  // Mark block in use.
+  }
+  freemap.nfree[start / BPB] -= n;
+  if(freemap.cursor < start + n)
+    freemap.cursor = start + n;
+  release(&freemap.lock);
+  if(n > 0)
+    bmwrite(&freemap.bm, start / BPB);
+  return n;
+}
+
+// Allocate a data block for ip: the next block of its allocation
+// window, which ireserve() has already marked in use, else goal,
+// else anywhere.
+// Caller must hold ip->lock.
+static uint
+balloc_data(struct inode *ip, uint goal)
+{
+  uint b;
+
+  if(ip->rsv_next < ip->rsv_end){
+    b = ip->rsv_next++;
+    bzero(ip->dev, b);
+    return b;
+  }
+  return balloc(ip->dev, goal);
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
 {
-  struct buf *bp;
-  int bi, m;
+  uint64 *w;
 
-  bp = bread(dev, BBLOCK(b, sb));
-  bi = b % BPB;
-  m = 1 << (bi % 8);
-  if((bp->data[bi/8] & m) == 0)
+  acquire(&freemap.lock);
+  w = bmword(&freemap.bm, b / BPB);
+  if(BMTEST(w, b % BPB) == 0)
     panic("freeing free block");
-  bp->data[bi/8] &= ~m;
-  if(logstate_get() != 0)
-    log_write(bp);
-  else 
-    bwrite(bp);//log_write(bp);
-  brelse(bp);
+  BMCLR(w, b % BPB);
+  freemap.nfree[b / BPB]++;
+  release(&freemap.lock);
+  bmwrite(&freemap.bm, b / BPB);
 }
 
 // Inodes.
@@ -137,18 +501,22 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a table entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in table: ip->ref tracks the number of
+//   in-memory pointers to a table entry (open files and
+//   current directories). iget() finds or creates a table
+//   entry and increments its ref; iput() decrements ref.
+//   Entries live on a hash chain keyed by (dev, inum). An
+//   entry whose ref falls to zero stays hashed, on an LRU
+//   list, so a later iget() finds it still valid and
+//   ilock() need not read the disk. Entries are carved out
+//   of kalloc() pages as needed; past NICACHE unreferenced
+//   entries, the least recently used is recycled.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees the inode on disk.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -173,64 +541,215 @@ bfree(int dev, uint b)
 // multi-step atomic operations.
 //
 // The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// entries, the hash chains and the LRU list. Since ip->ref
+// indicates whether an entry is in use, and ip->dev and
+// ip->inum indicate which i-node an entry holds, one must
+// hold itable.lock while using any of those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
-// dev, and inum.  One must hold ip->lock in order to
+// dev, inum and the list links.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+  struct inode lru;       // lru.lnext is most recently used
+  int nlru;               // entries on the LRU list
+  struct inode *free;     // unused entries, chained by hnext
 } itable;
 
+// Rotating cursor into the inode map: ialloc() resumes
+// scanning where the previous allocation left off.
+struct {
+  struct spinlock lock;
+  uint cursor;
+} imapcur;
+
+// The orphan list, see orphand().
+struct {
+  struct sleeplock chain; // protects sb.orphan and next_orphan
+  struct spinlock lock;
+  int pending;            // orphans added since orphand last looked
+} orphans;
+
+struct sleeplock renamelock;
+
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
+
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
+  itable.lru.lprev = itable.lru.lnext = &itable.lru;
+  initlock(&imapcur.lock, "imap");
+  initsleeplock(&renamelock, "rename");
+  initsleeplock(&orphans.chain, "orphans");
+  initlock(&orphans.lock, "orphans");
+}
+
+// Remove ip from its hash chain.
+// Caller must hold itable.lock.
+static void
+iunhash(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = &itable.hash[IHASH(ip->dev, ip->inum)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == ip){
+      *pp = ip->hnext;
+      ip->hnext = 0;
+      return;
+    }
   }
+  panic("iunhash");
+}
+
+static void
+lru_remove(struct inode *ip)
+{
+  ip->lprev->lnext = ip->lnext;
+  ip->lnext->lprev = ip->lprev;
+  ip->lprev = ip->lnext = 0;
+  itable.nlru--;
+}
+
+// Return an unused table entry: from the free list, else a
+// freshly carved kalloc() page, else the least recently used
+// unreferenced entry. Caller must hold itable.lock.
+static struct inode*
+inew(void)
+{
+  struct inode *ip;
+  char *pa;
+  int i;
+
+  if(itable.free == 0 && (pa = kalloc()) != 0){
+    memset(pa, 0, PGSIZE);
+    for(i = 0; i + sizeof(struct inode) <= PGSIZE; i += sizeof(struct inode)){
+      ip = (struct inode*)(pa + i);
+      initsleeplock(&ip->lock, "inode");
+      ip->hnext = itable.free;
+      itable.free = ip;
+    }
+  }
+  if((ip = itable.free) != 0){
+    itable.free = ip->hnext;
+    ip->hnext = 0;
+    return ip;
+  }
+  if((ip = itable.lru.lprev) != &itable.lru){
+    lru_remove(ip);
+    iunhash(ip);
+    return ip;
+  }
+  panic("iget: no inodes");
 }
 
 static struct inode* iget(uint dev, uint inum);
+static void bmap_forget(struct inode *ip);
+static void orphan_add(struct inode *ip);
+
+// Claim the first free inode at or after the cursor in the
+// inode map, skipping fully used words. Returns its number,
+// or 0 if the map is full.
+static uint
+imalloc(uint dev)
+{
+  uint64 *w;
+  uint start, inum, n, bi;
+
+  acquire(&imapcur.lock);
+  start = imapcur.cursor;
+  release(&imapcur.lock);
+  if(start == 0 || start >= sb.ninodes)
+    start = 1;
+
+  acquire(&freemap.lock);
+  for(n = 0; n < sb.ninodes; ){
+    inum = (start + n) % sb.ninodes;
+    w = bmword(&freemap.im, inum / BPB);
+    bi = inum % BPB;
+    if(bi % BPW == 0 && inum + BPW <= sb.ninodes && w[bi/BPW] == ~0UL){
+      n += BPW;
+      continue;
+    }
+    if(BMTEST(w, bi) == 0){
+      BMSET(w, bi);
+      release(&freemap.lock);
+      bmwrite(&freemap.im, inum / BPB);
+      acquire(&imapcur.lock);
+      imapcur.cursor = inum + 1;
+      release(&imapcur.lock);
+      return inum;
+    }
+    n++;
+  }
+  release(&freemap.lock);
+  return 0;
+}
+
+// Mark inode inum free in the inode map.
+static void
+imfree(uint dev, uint inum)
+{
+  uint64 *w;
+
+  acquire(&freemap.lock);
+  w = bmword(&freemap.im, inum / BPB);
+  if(BMTEST(w, inum % BPB) == 0)
+    panic("freeing free inode");
+  BMCLR(w, inum % BPB);
+  release(&freemap.lock);
+  bmwrite(&freemap.im, inum / BPB);
+}
 
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode.
-struct inode*
-ialloc(uint dev, short type)
+static struct inode*
+ialloc1(uint dev, short type)
 {
-  int inum;
+  int inum, n;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
+  // With an inode map, take inodes from it; a map bit that is
+  // clear for an inode in use is skipped and stays set.
+  // Without one, scan the inode blocks.
+  for(n = 1; n < sb.ninodes; n++){
+    if(sb.imapstart == 0)
+      inum = n;
+    else if((inum = imalloc(dev)) == 0)
+      break;
     bp = bread(dev, IBLOCK(inum, sb));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
+      if(type == T_FILE)
+        dip->iflags = INLINE_FL;
       dip->atime = ticks;
       dip->ctime = ticks;
       dip->mtime = ticks;
       dip->dtime = 0;
-  
-      if(logstate_get() != 0)
-        log_write(bp);
-      else 
-        bwrite(bp);//log_write(bp);   // mark it allocated on the disk
+      mwrite(bp);   // mark it allocated on the disk
 
       brelse(bp);
       return iget(dev, inum);
     }
     brelse(bp);
   }
-  panic("ialloc: no inodes");
+  return 0;
+}
+
+struct inode*
+ialloc(uint dev, short type)
+{
+  struct inode *ip;
+
+  if((ip = ialloc1(dev, type)) == 0)
+    panic("ialloc: no inodes");
+  return ip;
 }
 
 // Copy a modified in-memory inode to disk.
@@ -256,12 +775,14 @@ iupdate(struct inode *ip)
   dip->mtime = ip->mtime;
   dip->dtime = ip->dtime;
 
+  dip->iflags = ip->iflags;
+  dip->generation = ip->generation;
+  dip->gid = ip->gid;
+
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
-  if(logstate_get() != 0)
-  log_write(bp);
-  else 
-  bwrite(bp);//log_write(bp);
+  mwrite(bp);
   brelse(bp);
+  ip->dirty &= ~I_DIRTY_TIME;
 }
 
 // Find the inode with number inum on device dev
@@ -270,31 +791,29 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = itable.hash[IHASH(dev, inum)]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lru_remove(ip);
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
+  // Take a new or recycled entry.
+  ip = inew();
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->rsv_next = ip->rsv_end = 0;
+  ip->hnext = itable.hash[IHASH(dev, inum)];
+  itable.hash[IHASH(dev, inum)] = ip;
   release(&itable.lock);
 
   return ip;
@@ -325,6 +844,9 @@ ilock(struct inode *ip)
   acquiresleep(&ip->lock);
 
   if(ip->valid == 0){
+    bmap_forget(ip);
+    ip->dirty = 0;
+    ip->ccl = -1;
     bp = bread(ip->dev, IBLOCK(ip->inum, sb));
     dip = (struct dinode*)bp->data + ip->inum%IPB;
     ip->type = dip->type;
@@ -337,6 +859,9 @@ ilock(struct inode *ip)
     ip->ctime = dip->ctime;
     ip->mtime = dip->mtime;
     ip->dtime = dip->dtime;
+    ip->iflags = dip->iflags;
+    ip->generation = dip->generation;
+    ip->gid = dip->gid;
 
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
@@ -377,8 +902,8 @@ itimeset(struct inode *ip, uint at, uint ct, uint mt, uint dt)
 
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode table entry can
-// be recycled.
+// If that was the last reference, the inode table entry moves
+// to the LRU list, where it can be recycled.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -389,7 +914,8 @@ iput(struct inode *ip)
   acquire(&itable.lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
-    // inode has no links and no other references: truncate and free.
+    // inode has no links and no other references:
+    // leave it to orphand to truncate and free.
 
     // ip->ref == 1 means no other process can have ip locked,
     // so this acquiresleep() won't block (or deadlock).
@@ -397,17 +923,48 @@ iput(struct inode *ip)
 
     release(&itable.lock);
 
-    itrunc(ip);
-    ip->type = 0;
-    iupdate(ip);
-    ip->valid = 0;
+    if(ISDIR(ip->type))
+      dcache_purge(ip->dev, ip->inum);
+    orphan_add(ip);
 
     releasesleep(&ip->lock);
 
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  if(ip->ref == 1 && ip->valid && (ip->dirty & I_DIRTY_TIME)){
+    // last reference: write back lazily updated timestamps.
+    acquiresleep(&ip->lock);
+    release(&itable.lock);
+    iupdate(ip);
+    releasesleep(&ip->lock);
+    acquire(&itable.lock);
+  }
+
+  if(--ip->ref == 0){
+    if(ip->cbuf){
+      kfree(ip->cbuf);
+      ip->cbuf = 0;
+    }
+    if(!ip->valid){
+      // nothing worth caching
+      iunhash(ip);
+      ip->hnext = itable.free;
+      itable.free = ip;
+    } else {
+      ip->lnext = itable.lru.lnext;
+      ip->lprev = &itable.lru;
+      itable.lru.lnext->lprev = ip;
+      itable.lru.lnext = ip;
+      if(++itable.nlru > NICACHE){
+        struct inode *old = itable.lru.lprev;
+        lru_remove(old);
+        iunhash(old);
+        old->hnext = itable.free;
+        itable.free = old;
+      }
+    }
+  }
   release(&itable.lock);
 }
 
@@ -427,7 +984,8 @@ iunlockput(struct inode *ip)
 // listed in block ip->addrs[NDIRECT].
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one if alloc is set,
+// and otherwise returns 0.
 
 
 // Indirect-Path
@@ -435,8 +993,42 @@ iunlockput(struct inode *ip)
 // 给定深度，通过间接寻址寻找目标块，二重间接寻址深度为2
 // 
 
+// Forget what bmap() has cached about ip's block map.
+static void
+bmap_forget(struct inode *ip)
+{
+  ip->map_len = 0;
+  ip->map_ind = 0;
+}
+
+// Cache leaf indirect block bl, whose entry bn maps file block lbn:
+// remember bl itself, and the run of consecutive disk blocks that
+// starts at lbn, or extend the cached run if lbn was just added
+// right after it.
+static void
+bmap_remember(struct inode *ip, struct buf *bl, uint bn, uint lbn)
+{
+  uint *a = (uint*)bl->data;
+  uint n;
+
+  ip->map_ind = bl->blockno;
+  ip->map_indlbn = lbn - bn;
+  if(a[bn] == 0)
+    return;
+  if(ip->map_len && lbn == ip->map_lbn + ip->map_len &&
+     a[bn] == ip->map_pbn + ip->map_len){
+    ip->map_len++;
+    return;
+  }
+  for(n = 1; bn + n < NINDIRECT && a[bn + n] == a[bn] + n; n++)
+    ;
+  ip->map_lbn = lbn;
+  ip->map_pbn = a[bn];
+  ip->map_len = n;
+}
+
 static uint
-indirect_path(struct inode *ip, struct buf *bl, int depth, uint bn) // bn 应为残值
+indirect_path(struct inode *ip, struct buf *bl, int depth, uint bn, uint lbn, int alloc) // bn 应为残值, lbn 为原值
 {
   uint addr;
   uint *a;
@@ -450,11 +1042,12 @@ indirect_path(struct inode *ip, struct buf *bl, int depth, uint bn) // bn 应为
       panic("indirect path overflow");
     }
     addr = a[bn];
-    if (addr == 0)
+    if (addr == 0 && alloc)
     {
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bl);
+      a[bn] = addr = balloc_data(ip, 0);
+      mwrite(bl);
     }
+    bmap_remember(ip, bl, bn, lbn);
     brelse(bl);
     return addr;
   }
@@ -475,27 +1068,50 @@ indirect_path(struct inode *ip, struct buf *bl, int depth, uint bn) // bn 应为
     // 判断片选位是否初始化过
     if (a[bn_high] == 0)
     {
-      a[bn_high] = balloc(ip->dev);
-      log_write(bl);
+      if (!alloc)
+      {
+        brelse(bl);
+        return 0;
+      }
+      a[bn_high] = balloc(ip->dev, 0);
+      mwrite(bl);
     }
     struct buf *nextbl = bread(ip->dev, a[bn_high]);
-    addr = indirect_path(ip, nextbl, depth - 1, bn_low);
+    addr = indirect_path(ip, nextbl, depth - 1, bn_low, lbn, alloc);
     brelse(bl);
     return addr;
   }
 }
 
+static uint ext_bmap(struct inode *ip, uint bn, int alloc);
+
 static uint
-bmap(struct inode *ip, uint bn)
+bmap(struct inode *ip, uint bn, int alloc)
 {
-  uint addr;
+  uint addr, lbn;
   struct buf *bp;
 
+  if(ip->iflags & INLINE_FL)
+    panic("bmap: inline");
+  if(ip->iflags & EXTENT_FL)
+    return ext_bmap(ip, bn, alloc);
+
   if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+    if((addr = ip->addrs[bn]) == 0 && alloc)
+      ip->addrs[bn] = addr = balloc_data(ip, 0);
     return addr;
   }
+
+  // The run cache needs no reads at all; the cached leaf
+  // indirect block saves reading the ones above it.
+  if(bn - ip->map_lbn < ip->map_len)
+    return ip->map_pbn + (bn - ip->map_lbn);
+  if(ip->map_ind && bn - ip->map_indlbn < NINDIRECT){
+    bp = bread(ip->dev, ip->map_ind);
+    return indirect_path(ip, bp, 1, bn - ip->map_indlbn, bn, alloc);
+  }
+
+  lbn = bn;
   /*
   bn -= NDIRECT;
 
@@ -519,95 +1135,1067 @@ bmap(struct inode *ip, uint bn)
   bn -= NDIRECT;
   if(bn < NINDIRECT)
   {
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+    if((addr = ip->addrs[NDIRECT]) == 0){
+      if(!alloc)
+        return 0;
+      ip->addrs[NDIRECT] = addr = balloc(ip->dev, 0);
+    }
     bp = bread(ip->dev, addr);
-    return indirect_path(ip, bp, 1, bn);
+    return indirect_path(ip, bp, 1, bn, lbn, alloc);
   }
   bn -= NINDIRECT;
   if(bn < DOUBLE_INDIRECT)
   {
-    if((addr = ip->addrs[NDIRECT + 1]) == 0)
-      ip->addrs[NDIRECT + 1] = addr = balloc(ip->dev);
+    if((addr = ip->addrs[NDIRECT + 1]) == 0){
+      if(!alloc)
+        return 0;
+      ip->addrs[NDIRECT + 1] = addr = balloc(ip->dev, 0);
+    }
     bp = bread(ip->dev, addr);
-    return indirect_path(ip, bp, 2, bn);
+    return indirect_path(ip, bp, 2, bn, lbn, alloc);
   }
   bn -= DOUBLE_INDIRECT;
   if(bn < TRIPLE_INDIRECT)
   {
-    if((addr = ip->addrs[NDIRECT + 2]) == 0)
-      ip->addrs[NDIRECT + 2] = addr = balloc(ip->dev);
+    if((addr = ip->addrs[NDIRECT + 2]) == 0){
+      if(!alloc)
+        return 0;
+      ip->addrs[NDIRECT + 2] = addr = balloc(ip->dev, 0);
+    }
     bp = bread(ip->dev, addr);
-    return indirect_path(ip, bp, 3, bn);
+    return indirect_path(ip, bp, 3, bn, lbn, alloc);
   }
   
   panic("bmap: out of range");
 }
 
-// Truncate inode (discard contents).
-// Caller must hold ip->lock.
-void
-itrunc(struct inode *ip)
+// Extents.
+//
+// An inode with EXTENT_FL set maps its blocks with extents
+// (logical block, disk block, length) instead of direct and
+// indirect pointers; addrs[] holds the root of a small extent
+// tree, see fs.h. A contiguous file of any size needs a single
+// extent, so mapping a block costs no I/O at depth 0 and one
+// leaf block read at depth 1.
+
+#define EXT_ROOT(ip)    ((struct ext_header*)(ip)->addrs)
+#define EXT_ENTRY(eh)   ((struct extent*)((eh) + 1))
+
+// Index of the last of the n sorted entries e[] that starts
+// at or before logical block bn, or -1 if there is none.
+static int
+ext_find(struct extent *e, int n, uint bn)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
-
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
+  int lo, hi, mid, r;
+
+  r = -1;
+  lo = 0;
+  hi = n - 1;
+  while(lo <= hi){
+    mid = (lo + hi) / 2;
+    if(e[mid].lblk <= bn){
+      r = mid;
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
     }
   }
+  return r;
+}
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
-  }
+// Insert x into the n sorted entries e[], which must have room.
+static void
+ext_put(struct extent *e, ushort *n, struct extent *x)
+{
+  int i;
 
-  ip->size = 0;
-  iupdate(ip);
+  for(i = *n; i > 0 && e[i-1].lblk > x->lblk; i--)
+    e[i] = e[i-1];
+  e[i] = *x;
+  (*n)++;
 }
 
-// Copy stat information from inode.
-// Caller must hold ip->lock.
-void
-stati(struct inode *ip, struct stat *st)
+// Return the extent list that would hold logical block bn:
+// the root at depth 0, else the leaf block, which is
+// returned locked in *bpp for the caller to brelse().
+static struct ext_header*
+ext_leaf(struct inode *ip, uint bn, struct buf **bpp)
 {
-  st->dev = ip->dev;
-  st->ino = ip->inum;
-  st->type = ip->type;
-  st->nlink = ip->nlink;
-  st->size = ip->size;
+  struct ext_header *eh;
+  struct extent *e;
+  int i;
+
+  eh = EXT_ROOT(ip);
+  *bpp = 0;
+  if(eh->depth == 0)
+    return eh;
+  e = EXT_ENTRY(eh);
+  if((i = ext_find(e, eh->n, bn)) < 0)
+    i = 0;
+  *bpp = bread(ip->dev, e[i].pblk);
+  return (struct ext_header*)(*bpp)->data;
 }
 
-// Read data from inode.
-// Caller must hold ip->lock.
-// If user_dst==1, then dst is a user virtual address;
-// otherwise, dst is a kernel address.
-int
-readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+// Return the disk block holding logical block bn of
+// extent-mapped inode ip, or 0 if bn is not mapped.
+// Sets *unwritten if the block is in an unwritten extent.
+static uint
+ext_lookup(struct inode *ip, uint bn, int *unwritten)
 {
-  uint tot, m;
+  struct ext_header *eh;
+  struct extent *e;
   struct buf *bp;
+  uint addr;
+  int i;
+
+  addr = 0;
+  *unwritten = 0;
+  eh = ext_leaf(ip, bn, &bp);
+  e = EXT_ENTRY(eh);
+  i = ext_find(e, eh->n, bn);
+  if(i >= 0 && bn < e[i].lblk + EXT_LEN(&e[i])){
+    addr = e[i].pblk + (bn - e[i].lblk);
+    *unwritten = (e[i].len & EXT_UNWRITTEN) != 0;
+  }
+  if(bp)
+    brelse(bp);
+  return addr;
+}
 
-  if(off > ip->size || off + n < off)
-    return 0;
-  if(off + n > ip->size)
-    n = ip->size - off;
+// Add extent x to ip's tree, growing the tree as needed.
+// Returns -1 if the tree is full.
+static int
+ext_insert(struct inode *ip, struct extent *x)
+{
+  struct ext_header *eh, *lh, *nh;
+  struct extent *e;
+  struct buf *bp, *nbp;
+  uint leaf;
+  int i, half;
+
+  eh = EXT_ROOT(ip);
+  e = EXT_ENTRY(eh);
+  if(eh->depth == 0){
+    if(eh->n < NEXT_ROOT){
+      ext_put(e, &eh->n, x);
+      return 0;
+    }
+    // Root is full: move its extents down into a leaf,
+    // and make the root an index with one entry.
+    leaf = balloc(ip->dev, 0);
+    bp = bread(ip->dev, leaf);
+    lh = (struct ext_header*)bp->data;
+    lh->n = eh->n;
+    lh->depth = 0;
+    memmove(EXT_ENTRY(lh), e, eh->n * sizeof(*e));
+    mwrite(bp);
+    brelse(bp);
+    eh->depth = 1;
+    eh->n = 1;
+    e[0].lblk = 0;
+    e[0].pblk = leaf;
+    e[0].len = 0;
+  }
 
-  ip->atime = ticks;
+  if((i = ext_find(e, eh->n, x->lblk)) < 0)
+    i = 0;
+  bp = bread(ip->dev, e[i].pblk);
+  lh = (struct ext_header*)bp->data;
+  if(lh->n == NEXT_LEAF){
+    // Leaf is full: move its upper half to a new leaf.
+    if(eh->n == NEXT_ROOT){
+      brelse(bp);
+      return -1;
+    }
+    leaf = balloc(ip->dev, 0);
+    nbp = bread(ip->dev, leaf);
+    nh = (struct ext_header*)nbp->data;
+    half = lh->n / 2;
+    nh->n = lh->n - half;
+    nh->depth = 0;
+    memmove(EXT_ENTRY(nh), EXT_ENTRY(lh) + half, nh->n * sizeof(*e));
+    lh->n = half;
+    memmove(&e[i+2], &e[i+1], (eh->n - i - 1) * sizeof(*e));
+    e[i+1].lblk = EXT_ENTRY(nh)[0].lblk;
+    e[i+1].pblk = leaf;
+    e[i+1].len = 0;
+    eh->n++;
+    if(x->lblk >= e[i+1].lblk){
+      mwrite(bp);
+      brelse(bp);
+      bp = nbp;
+      lh = nh;
+    } else {
+      mwrite(nbp);
+      brelse(nbp);
+    }
+  }
+  ext_put(EXT_ENTRY(lh), &lh->n, x);
+  mwrite(bp);
+  brelse(bp);
+  return 0;
+}
+
+// Allocate a disk block for unmapped logical block bn,
+// preferably the one that lets the preceding extent
+// simply grow by one. Returns 0 if the tree is full.
+static uint
+ext_alloc(struct inode *ip, uint bn)
+{
+  struct ext_header *eh;
+  struct extent *e, x;
+  struct buf *bp;
+  uint addr, goal;
+  int i;
+
+  goal = 0;
+  eh = ext_leaf(ip, bn, &bp);
+  e = EXT_ENTRY(eh);
+  i = ext_find(e, eh->n, bn);
+  if(i >= 0)
+    goal = e[i].pblk + (bn - e[i].lblk);
+  addr = balloc_data(ip, goal);
+  if(i >= 0 && !(e[i].len & EXT_UNWRITTEN) &&
+     e[i].lblk + e[i].len == bn && addr == goal){
+    e[i].len++;
+    if(bp){
+      mwrite(bp);
+      brelse(bp);
+    }
+    return addr;
+  }
+  if(bp)
+    brelse(bp);
+
+  x.lblk = bn;
+  x.pblk = addr;
+  x.len = 1;
+  if(ext_insert(ip, &x) < 0){
+    bfree(ip->dev, addr);
+    return 0;
+  }
+  return addr;
+}
+
+// Mark block bn of an unwritten extent of ip written, zero it and
+// return it. The extent splits into an unwritten head before bn,
+// bn itself, which joins the written extent before it if it can,
+// and an unwritten tail. Returns 0 if the tree is full, after
+// giving up the preallocated blocks that no longer fit.
+static uint
+ext_convert(struct inode *ip, uint bn)
+{
+  struct ext_header *eh;
+  struct extent *e, *p, mid, tail;
+  struct buf *bp;
+  uint addr, j;
+  int i, inmid;
+
+  eh = ext_leaf(ip, bn, &bp);
+  e = EXT_ENTRY(eh);
+  i = ext_find(e, eh->n, bn);
+  addr = e[i].pblk + (bn - e[i].lblk);
+  mid.lblk = bn;
+  mid.pblk = addr;
+  mid.len = 1;
+  tail.lblk = bn + 1;
+  tail.pblk = addr + 1;
+  tail.len = e[i].lblk + EXT_LEN(&e[i]) - tail.lblk;
+
+  inmid = 1;    // mid still needs inserting
+  p = i > 0 ? &e[i-1] : 0;
+  if(bn > e[i].lblk){
+    e[i].len = (bn - e[i].lblk) | EXT_UNWRITTEN;
+  } else if(tail.len == 0){
+    e[i].len = 1;
+    inmid = 0;
+  } else if(p && !(p->len & EXT_UNWRITTEN) &&
+            p->lblk + p->len == bn && p->pblk + p->len == addr){
+    p->len++;
+    e[i] = tail;
+    e[i].len |= EXT_UNWRITTEN;
+    inmid = 0;
+    tail.len = 0;
+  } else {
+    e[i] = mid;
+    inmid = 0;
+  }
+  if(bp){
+    mwrite(bp);
+    brelse(bp);
+  }
+
+  if(inmid && ext_insert(ip, &mid) < 0){
+    for(j = 0; j < 1 + tail.len; j++)
+      bfree(ip->dev, addr + j);
+    return 0;
+  }
+  if(tail.len){
+    tail.len |= EXT_UNWRITTEN;
+    if(ext_insert(ip, &tail) < 0)
+      for(j = 0; j < EXT_LEN(&tail); j++)
+        bfree(ip->dev, tail.pblk + j);
+  }
+  bzero(ip->dev, addr);
+  return addr;
+}
+
+static uint
+ext_bmap(struct inode *ip, uint bn, int alloc)
+{
+  uint addr;
+  int unwritten;
+
+  addr = ext_lookup(ip, bn, &unwritten);
+  if(unwritten)
+    return alloc ? ext_convert(ip, bn) : 0;
+  if(addr != 0 || !alloc)
+    return addr;
+  return ext_alloc(ip, bn);
+}
+
+// Set up ip's allocation window for a write of n bytes at off,
+// so that the blocks it adds past the end of the file come out
+// of one free run placed right after the file's last block.
+// The whole run is claimed here with one bitmap update, and
+// balloc_data() then hands its blocks out without touching the
+// bitmap; irelease() gives back what the write did not use, and
+// must be called in the same transaction, so that a crash never
+// leaves claimed blocks that no inode points to.
+// Returns 1 if it set up a window.
+// Caller must hold ip->lock, inside a transaction.
+int
+ireserve(struct inode *ip, uint off, uint n)
+{
+  uint b0, b1, goal, start, len;
+
+  if(ip->type != T_FILE || n == 0)
+    return 0;
+  if(ip->iflags & INLINE_FL){
+    if(off + n <= NINLINE)
+      return 0;
+    b0 = 0;     // its data moves to block 0
+  } else
+    b0 = (ip->size + BSIZE - 1) / BSIZE;
+  if(off / BSIZE > b0)
+    b0 = off / BSIZE;
+  b1 = (off + n - 1) / BSIZE;
+  if(b1 < b0 + 1)
+    return 0;   // one block or less: plain goal allocation will do
+
+  goal = 0;
+  if(b0 > 0 && !(ip->iflags & INLINE_FL) && (goal = bmap(ip, b0 - 1, 0)) != 0)
+    goal++;
+  if((start = brun(ip->dev, goal, b1 - b0 + 1, &len)) == 0 ||
+     (len = btake(ip->dev, start, len)) == 0)
+    return 0;
+  ip->rsv_next = start;
+  ip->rsv_end = start + len;
+  return 1;
+}
+
+// Free the blocks of ip's allocation window that it has not used.
+// They all lie under one bitmap block, so this dirties just that.
+// Caller must hold ip->lock, inside a transaction.
+void
+irelease(struct inode *ip)
+{
+  uint b;
+
+  for(b = ip->rsv_next; b < ip->rsv_end; b++)
+    bfree(ip->dev, b);
+  ip->rsv_next = ip->rsv_end = 0;
+}
+
+// Freeing a file's blocks takes a bitmap block write per bitmap
+// block involved, and a large file can involve more than a
+// transaction can carry. So iput() does not free an inode itself:
+// it puts it on the orphan list, and the orphand kernel thread
+// frees its blocks a transaction's worth at a time, then the inode.
+// The list is chained on disk from sb.orphan through each dinode's
+// next_orphan, so after a crash fsinit() finds the orphans whose
+// freeing was cut short and orphand finishes it. Only the holder
+// of orphans.chain touches the chain; iupdate() leaves next_orphan
+// alone, so it needs no in-memory copy.
+
+// Bitmap blocks one truncation step may dirty. The rest of its
+// transaction is the inode, up to three indirect blocks on the
+// path being freed, and a block of slop.
+#define NTBMAP (MAXOPBLOCKS - 5)
+
+struct tctx {
+  uint dev;
+  int n;
+  uint bmap[NTBMAP];    // bitmap blocks dirtied so far
+};
+
+// Free block b, unless that would dirty one bitmap block
+// too many. Returns 1 if it freed b.
+static int
+tfree(struct tctx *t, uint b)
+{
+  int i;
+
+  for(i = 0; i < t->n && t->bmap[i] != BBLOCK(b, sb); i++)
+    ;
+  if(i == t->n){
+    if(t->n == NTBMAP)
+      return 0;
+    t->bmap[t->n++] = BBLOCK(b, sb);
+  }
+  bfree(t->dev, b);
+  return 1;
+}
+
+// Free indirect block addr and what is below it, as far as t
+// allows; depth is 1 for a block of data block pointers. Entries
+// freed are cleared, so a later call carries on where this one
+// stopped. Returns 1 if addr itself was freed.
+static int
+trunc_ind(struct tctx *t, uint addr, int depth)
+{
+  struct buf *bp;
+  uint *a;
+  int j, dirty;
+
+  bp = bread(t->dev, addr);
+  a = (uint*)bp->data;
+  dirty = 0;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(depth > 1 ? !trunc_ind(t, a[j], depth - 1) : !tfree(t, a[j]))
+      break;
+    a[j] = 0;
+    dirty = 1;
+  }
+  if(j == NINDIRECT && tfree(t, addr)){
+    brelse(bp);   // gone, no need to write it
+    return 1;
+  }
+  if(dirty)
+    mwrite(bp);
+  brelse(bp);
+  return 0;
+}
+
+// Free the blocks of the *n extents e[], last block first, as far
+// as t allows, shrinking *n and the last extent as it goes.
+// Returns 1 if all were freed.
+static int
+ext_free_some(struct tctx *t, struct extent *e, ushort *n)
+{
+  struct extent *x;
+
+  while(*n > 0){
+    x = &e[*n - 1];
+    for(; EXT_LEN(x) > 0; x->len--)
+      if(!tfree(t, x->pblk + EXT_LEN(x) - 1))
+        return 0;
+    (*n)--;
+  }
+  return 1;
+}
+
+// Free some of ip's blocks, as many as one transaction can carry.
+// Returns 1 once ip has none left. Caller must hold ip->lock,
+// inside a transaction, and iupdate() ip afterwards.
+static int
+itrunc_some(struct inode *ip)
+{
+  struct ext_header *eh;
+  struct extent *e;
+  struct buf *bp;
+  struct tctx t;
+  int i, r;
+
+  t.dev = ip->dev;
+  t.n = 0;
+  if(ip->iflags & INLINE_FL){
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    return 1;
+  }
+
+  if(ip->iflags & EXTENT_FL){
+    eh = EXT_ROOT(ip);
+    e = EXT_ENTRY(eh);
+    if(eh->depth == 0){
+      if(!ext_free_some(&t, e, &eh->n))
+        return 0;
+    } else {
+      for(; eh->n > 0; eh->n--){
+        bp = bread(ip->dev, e[eh->n - 1].pblk);
+        r = ext_free_some(&t, EXT_ENTRY((struct ext_header*)bp->data),
+                          &((struct ext_header*)bp->data)->n);
+        if(!r || !tfree(&t, e[eh->n - 1].pblk)){
+          mwrite(bp);
+          brelse(bp);
+          return 0;
+        }
+        brelse(bp);
+      }
+    }
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    return 1;
+  }
+
+  // triple, double and single indirect trees, then direct blocks
+  for(i = 2; i >= 0; i--){
+    if(ip->addrs[NDIRECT + i] == 0)
+      continue;
+    if(!trunc_ind(&t, ip->addrs[NDIRECT + i], i + 1))
+      return 0;
+    ip->addrs[NDIRECT + i] = 0;
+  }
+  for(i = NDIRECT - 1; i >= 0; i--){
+    if(ip->addrs[i] == 0)
+      continue;
+    if(!tfree(&t, ip->addrs[i]))
+      return 0;
+    ip->addrs[i] = 0;
+  }
+  return 1;
+}
+
+// Read or write the next_orphan field of inode inum.
+// Caller must hold orphans.chain.
+static uint
+onext(uint dev, uint inum)
+{
+  struct buf *bp;
+  uint next;
+
+  bp = bread(dev, IBLOCK(inum, sb));
+  next = ((struct dinode*)bp->data + inum%IPB)->next_orphan;
+  brelse(bp);
+  return next;
+}
+
+static void
+osetnext(uint dev, uint inum, uint next)
+{
+  struct buf *bp;
+
+  bp = bread(dev, IBLOCK(inum, sb));
+  ((struct dinode*)bp->data + inum%IPB)->next_orphan = next;
+  mwrite(bp);
+  brelse(bp);
+}
+
+// Write the in-memory super block back to disk.
+static void
+writesb(int dev)
+{
+  struct buf *bp;
+
+  bp = bread(dev, 1);
+  memmove(bp->data, &sb, sizeof(sb));
+  mwrite(bp);
+  brelse(bp);
+}
+
+// Put ip, which has no links, on the orphan list.
+// Caller must hold ip->lock, inside a transaction.
+static void
+orphan_add(struct inode *ip)
+{
+  acquiresleep(&orphans.chain);
+  osetnext(ip->dev, ip->inum, sb.orphan);
+  sb.orphan = ip->inum;
+  writesb(ip->dev);
+  releasesleep(&orphans.chain);
+
+  acquire(&orphans.lock);
+  orphans.pending = 1;
+  wakeup(&orphans);
+  release(&orphans.lock);
+}
+
+// Take inode inum off the orphan list.
+// Must be called inside a transaction.
+static void
+orphan_del(uint dev, uint inum)
+{
+  uint p, next;
+
+  acquiresleep(&orphans.chain);
+  if(sb.orphan == inum){
+    sb.orphan = onext(dev, inum);
+    writesb(dev);
+  } else {
+    for(p = sb.orphan; (next = onext(dev, p)) != inum; p = next)
+      if(next == 0)
+        panic("orphan_del");
+    osetnext(dev, p, onext(dev, inum));
+  }
+  osetnext(dev, inum, 0);
+  releasesleep(&orphans.chain);
+}
+
+// Body of the orphand kernel thread: free the inodes on the
+// orphan list and their blocks, starting with any a crash left.
+void
+orphand(void)
+{
+  struct inode *ip;
+  uint inum;
+  int done;
+
+  for(;;){
+    for(;;){
+      acquiresleep(&orphans.chain);
+      inum = sb.orphan;
+      releasesleep(&orphans.chain);
+      if(inum == 0)
+        break;
+
+      ip = iget(ROOTDEV, inum);
+      do {
+        begin_op();
+        ilock(ip);
+        done = itrunc_some(ip);
+        iupdate(ip);
+        iunlock(ip);
+        end_op();
+      } while(!done);
+
+      begin_op();
+      ilock(ip);
+      orphan_del(ip->dev, ip->inum);
+      ip->size = 0;
+      ip->type = 0;
+      ip->dtime = ticks;
+      iupdate(ip);
+      if(sb.imapstart)
+        imfree(ip->dev, ip->inum);
+      ip->valid = 0;
+      iunlock(ip);
+      iput(ip);
+      end_op();
+    }
+
+    acquire(&orphans.lock);
+    while(orphans.pending == 0)
+      sleep(&orphans, &orphans.lock);
+    orphans.pending = 0;
+    release(&orphans.lock);
+  }
+}
+
+// Truncate inode (discard contents). The blocks move to a new
+// inode with no links, which iput() hands to orphand to free.
+// Caller must hold ip->lock, inside a transaction.
+void
+itrunc(struct inode *ip)
+{
+  struct inode *gp;
+  int i;
+
+  bmap_forget(ip);
+  ip->ccl = -1;
+  for(i = 0; i < NDIRECT+3 && ip->addrs[i] == 0; i++)
+    ;
+  if(!(ip->iflags & INLINE_FL) && i < NDIRECT+3){
+    if((gp = ialloc1(ip->dev, T_FILE)) != 0){
+      ilock(gp);
+      memmove(gp->addrs, ip->addrs, sizeof(ip->addrs));
+      gp->iflags = ip->iflags & EXTENT_FL;
+      gp->size = ip->size;
+      gp->nlink = 0;
+      iupdate(gp);
+      iunlockput(gp);
+    } else {
+      // no inode to spare: free them here and now
+      while(!itrunc_some(ip))
+        ;
+    }
+  }
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  ip->size = 0;
+  iupdate(ip);
+}
+
+// Change ip's flags: set the bits in set, then clear those
+// in clear. The block mapping format (EXTENT_FL) and compression
+// (COMPR_FL, which needs the block map) can only change while
+// the file has no blocks. Returns the new flags,
+// or -1. Caller must hold ip->lock, inside a transaction.
+int
+isetflags(struct inode *ip, uint set, uint clear)
+{
+  uint flags;
+  int i;
+
+  set &= ~INLINE_FL;
+  clear &= ~INLINE_FL;
+  flags = (ip->iflags | set) & ~clear;
+  if(flags == ip->iflags)
+    return flags;
+  if((flags & (EXTENT_FL|COMPR_FL)) == (EXTENT_FL|COMPR_FL))
+    return -1;  // compressed clusters need the block map
+  if((flags ^ ip->iflags) & (EXTENT_FL|COMPR_FL)){
+    if(ip->type != T_FILE || ip->size != 0)
+      return -1;
+    for(i = 0; i < NDIRECT+3; i++)
+      if(ip->addrs[i])
+        return -1;
+  }
+  ip->iflags = flags;
+  iupdate(ip);
+  return flags;
+}
+
+// Timestamps are lazy: a change that only touches atime or mtime
+// marks the in-memory inode I_DIRTY_TIME instead of writing it.
+// The next iupdate() for any other reason carries the times to
+// disk, and so does iput() when it drops the last reference.
+
+static int atimemode = ATIME_RELATIME;
+
+#define RELATIME_TICKS (24*60*60*10)  // a day, at 10 ticks a second
+
+// Set the atime mode to mode, or just query it if mode is -1.
+// Returns the previous mode.
+int
+atimeswitch(int mode)
+{
+  int old = atimemode;
+
+  if(mode >= ATIME_STRICT && mode <= ATIME_NOATIME)
+    atimemode = mode;
+  return old;
+}
+
+// Note a read of ip in its atime, as the mount-wide mode and
+// NOATIME_FL allow. Caller must hold ip->lock.
+static void
+itouch(struct inode *ip)
+{
+  if(atimemode == ATIME_NOATIME || (ip->iflags & NOATIME_FL))
+    return;
+  if(atimemode == ATIME_RELATIME && ip->atime > ip->mtime &&
+     ip->atime > ip->ctime && ticks - ip->atime < RELATIME_TICKS)
+    return;
+  if(ip->atime == ticks)
+    return;
+  ip->atime = ticks;
+  ip->dirty |= I_DIRTY_TIME;
+}
+
+// Copy stat information from inode.
+// Caller must hold ip->lock.
+void
+stati(struct inode *ip, struct stat *st)
+{
+  st->dev = ip->dev;
+  st->ino = ip->inum;
+  st->type = ip->type;
+  st->nlink = ip->nlink;
+  st->size = ip->size;
+}
+
+// Find the first offset at or after off that lies in data
+// (hole==0) or in a hole (hole==1), to the granularity of a block,
+// or of a cluster for compressed files. The end of the file counts
+// as a hole. Returns -1 if off is at or past the end of the file,
+// or no data follows it.
+// Caller must hold ip->lock.
+int
+iseekdata(struct inode *ip, uint off, int hole)
+{
+  uint unit, u;
+  int mapped;
+
+  if(off >= ip->size)
+    return -1;
+  if(ip->iflags & INLINE_FL)
+    return hole ? ip->size : off;
+  unit = (ip->iflags & COMPR_FL) ? CSIZE : BSIZE;
+  for(u = off / unit; u * unit < ip->size; u++){
+    mapped = bmap(ip, u * unit / BSIZE, 0) != 0;
+    if(mapped != hole)
+      return u * unit > off ? u * unit : off;
+  }
+  return hole ? ip->size : -1;
+}
+
+// Compressed files (COMPR_FL).
+//
+// File data is handled in clusters of CLUSTER blocks. The block map
+// doubles as the cluster map: a cluster whose data needs nraw blocks
+// is stored raw in its first nraw block slots, or compressed in
+// fewer, with the rest unmapped. Compressed clusters start with
+// their compressed length and are only kept if they save a block.
+// Each inode has a one-cluster staging page: reads decompress a
+// cluster there once, writes modify it there and recompress it
+// before writei() returns.
+
+// Unmap block bn of block-mapped inode ip and return the disk
+// block it was mapped to, or 0.
+static uint
+bunmap(struct inode *ip, uint bn)
+{
+  struct buf *bp;
+  uint addr, per, level, i, *a;
+
+  bmap_forget(ip);
+  if(bn < NDIRECT){
+    addr = ip->addrs[bn];
+    ip->addrs[bn] = 0;
+    return addr;
+  }
+  bn -= NDIRECT;
+  for(level = 0, per = NINDIRECT; bn >= per; level++){
+    bn -= per;
+    per *= NINDIRECT;
+  }
+  addr = ip->addrs[NDIRECT + level];
+  while(addr){
+    per /= NINDIRECT;
+    bp = bread(ip->dev, addr);
+    a = (uint*)bp->data;
+    i = bn / per;
+    bn %= per;
+    addr = a[i];
+    if(per == 1){
+      if(addr){
+        a[i] = 0;
+        mwrite(bp);
+      }
+      brelse(bp);
+      return addr;
+    }
+    brelse(bp);
+  }
+  return 0;
+}
+
+// Blocks the data of cluster c needs uncompressed.
+static int
+craw(struct inode *ip, uint c)
+{
+  uint start = c * CSIZE;
+
+  if(start >= ip->size)
+    return 0;
+  return (min(ip->size - start, CSIZE) + BSIZE - 1) / BSIZE;
+}
+
+// Write a block of file data, as writei() does.
+static void
+dwrite(struct buf *bp)
+{
+  if(logstate_get() == 1)
+    log_write(bp);
+  else
+    bwrite(bp);
+}
+
+// Stage cluster c of ip in ip->cbuf.
+static int
+cload(struct inode *ip, uint c)
+{
+  struct buf *bp;
+  char *tmp;
+  uint addr, clen;
+  int i, k, nraw;
+
+  if(ip->cbuf && ip->ccl == c)
+    return 0;
+  if(ip->cbuf == 0 && (ip->cbuf = kalloc()) == 0)
+    return -1;
+  ip->ccl = -1;
+  memset(ip->cbuf, 0, CSIZE);
+
+  nraw = craw(ip, c);
+  for(k = 0; k < nraw && bmap(ip, c*CLUSTER + k, 0); k++)
+    ;
+  if(k == 0){
+    // a hole: all zeros
+  } else if(k == nraw){
+    for(i = 0; i < nraw; i++){
+      bp = bread(ip->dev, bmap(ip, c*CLUSTER + i, 0));
+      memmove(ip->cbuf + i*BSIZE, bp->data, BSIZE);
+      brelse(bp);
+    }
+  } else {
+    if((tmp = kalloc()) == 0)
+      return -1;
+    for(i = 0; i < k; i++){
+      addr = bmap(ip, c*CLUSTER + i, 0);
+      bp = bread(ip->dev, addr);
+      memmove(tmp + i*BSIZE, bp->data, BSIZE);
+      brelse(bp);
+    }
+    clen = *(uint*)tmp;
+    if(clen > k*BSIZE - sizeof(uint) ||
+       lz_decompress((uchar*)tmp + sizeof(uint), clen, (uchar*)ip->cbuf, CSIZE) < 0){
+      kfree(tmp);
+      printf("cload: inode %d cluster %d corrupt\n", ip->inum, c);
+      return -1;
+    }
+    kfree(tmp);
+  }
+  ip->ccl = c;
+  return 0;
+}
+
+// Store the staged cluster, compressed if that saves a block.
+static int
+ccommit(struct inode *ip)
+{
+  struct buf *bp;
+  char *out, *data;
+  uint c, addr;
+  int i, k, nraw, clen;
+
+  c = ip->ccl;
+  nraw = craw(ip, c);
+  if((out = kalloc()) == 0)
+    return -1;
+  clen = -1;
+  if(nraw > 1)
+    clen = lz_compress((uchar*)ip->cbuf, min(ip->size - c*CSIZE, CSIZE),
+                       (uchar*)out + sizeof(uint), (nraw-1)*BSIZE - sizeof(uint));
+  if(clen >= 0){
+    *(uint*)out = clen;
+    k = (clen + sizeof(uint) + BSIZE - 1) / BSIZE;
+    data = out;
+  } else {
+    k = nraw;
+    data = ip->cbuf;
+  }
+
+  for(i = 0; i < k; i++){
+    if((addr = bmap(ip, c*CLUSTER + i, 1)) == 0){
+      kfree(out);
+      return -1;
+    }
+    bp = bnew(ip->dev, addr);
+    memmove(bp->data, data + i*BSIZE, BSIZE);
+    bp->valid = 1;
+    dwrite(bp);
+    brelse(bp);
+  }
+  for(; i < CLUSTER; i++)
+    if((addr = bunmap(ip, c*CLUSTER + i)) != 0)
+      bfree(ip->dev, addr);
+  kfree(out);
+  return 0;
+}
+
+// readi() for COMPR_FL files.
+static int
+creadi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+{
+  uint tot, m;
+
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    if(cload(ip, off / CSIZE) < 0)
+      break;
+    m = min(n - tot, CSIZE - off%CSIZE);
+    if(either_copyout(user_dst, dst, ip->cbuf + off%CSIZE, m) == -1)
+      return -1;
+  }
+  return tot;
+}
+
+// A write at off past the end of compressed file ip leaves the
+// clusters in between unmapped, as holes. But once the file grows,
+// its old last cluster, if stored raw, maps fewer blocks than it
+// spans and cload() would take it for compressed, so store it
+// again first, padded with zeros to its end. filewrite() calls
+// this in a transaction of its own. Returns 1 if it stored the
+// cluster, 0 if there was no need, or -1.
+// Caller must hold ip->lock.
+int
+cextend(struct inode *ip, uint off)
+{
+  uint c, osize;
+
+  c = ip->size / CSIZE;
+  if(!(ip->iflags & COMPR_FL) || off <= ip->size ||
+     ip->size % CSIZE == 0 || off / CSIZE == c)
+    return 0;
+  if(cload(ip, c) < 0)
+    return -1;
+  osize = ip->size;
+  ip->size = (c + 1) * CSIZE;
+  if(ccommit(ip) < 0){
+    ip->size = osize;
+    ip->ccl = -1;
+    return -1;
+  }
+  iupdate(ip);
+  return 1;
+}
+
+// writei() for COMPR_FL files. Every cluster written is committed
+// before returning; filewrite() keeps each call within one cluster.
+static int
+cwritei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
+{
+  uint tot, m;
+
+  if(cextend(ip, off) < 0)
+    return 0;
+  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
+    if(cload(ip, off / CSIZE) < 0)
+      break;
+    m = min(n - tot, CSIZE - off%CSIZE);
+    if(either_copyin(ip->cbuf + off%CSIZE, user_src, src, m) == -1){
+      ip->ccl = -1;
+      break;
+    }
+    if(off + m > ip->size)
+      ip->size = off + m;
+    if(ccommit(ip) < 0){
+      ip->ccl = -1;
+      break;
+    }
+  }
+  return tot;
+}
+
+// What a hole reads as.
+static char zeroes[BSIZE];
+
+// Read data from inode.
+// Unmapped blocks are holes and read as zeros.
+// Caller must hold ip->lock.
+// If user_dst==1, then dst is a user virtual address;
+// otherwise, dst is a kernel address.
+int
+readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+{
+  uint tot, m, addr;
+  struct buf *bp;
+
+  if(off > ip->size || off + n < off)
+    return 0;
+  if(off + n > ip->size)
+    n = ip->size - off;
+
+  itouch(ip);
+
+  if(ip->iflags & INLINE_FL){
+    if(either_copyout(user_dst, dst, (char*)ip->addrs + off, n) == -1)
+      return -1;
+    return n;
+  }
+  if(ip->iflags & COMPR_FL)
+    return creadi(ip, user_dst, dst, off, n);
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
+    if((addr = bmap(ip, off/BSIZE, 0)) == 0){
+      if(either_copyout(user_dst, dst, zeroes, m) == -1){
+        tot = -1;
+        break;
+      }
+      continue;
+    }
+    bp = bread(ip->dev, addr);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
       brelse(bp);
       tot = -1;
@@ -618,7 +2206,34 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
+// Move ip's inline data out to a block of its own.
+// Caller must hold ip->lock.
+static int
+inline_migrate(struct inode *ip)
+{
+  char data[NINLINE];
+  struct buf *bp;
+  uint addr;
+
+  memmove(data, ip->addrs, NINLINE);
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  ip->iflags &= ~INLINE_FL;
+  if(ip->size == 0)
+    return 0;
+  if((addr = bmap(ip, 0, 1)) == 0){
+    memmove(ip->addrs, data, NINLINE);
+    ip->iflags |= INLINE_FL;
+    return -1;
+  }
+  bp = bread(ip->dev, addr);
+  memmove(bp->data, data, ip->size);
+  dwrite(bp);
+  brelse(bp);
+  return 0;
+}
+
 // Write data to inode.
+// Writing past the end of the file leaves a hole in between.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
 // otherwise, src is a kernel address.
@@ -628,40 +2243,122 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr, osize, oflags;
+  uint oaddrs[NDIRECT+3];
   struct buf *bp;
 
-  if(off > ip->size || off + n < off)
+  if(off + n < off)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
-  ip->atime = ticks;
   ip->mtime = ticks;
 
-  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
+  if(ip->iflags & INLINE_FL){
+    if(off + n <= NINLINE){
+      if(off > ip->size)
+        memset((char*)ip->addrs + ip->size, 0, off - ip->size);
+      if(either_copyin((char*)ip->addrs + off, user_src, src, n) == -1)
+        return -1;
+      if(off + n > ip->size)
+        ip->size = off + n;
+      iupdate(ip);
+      return n;
+    }
+    if(inline_migrate(ip) < 0)
+      return -1;
+  }
+
+  osize = ip->size;
+  oflags = ip->iflags;
+  memmove(oaddrs, ip->addrs, sizeof(oaddrs));
+
+  if(ip->iflags & COMPR_FL){
+    tot = cwritei(ip, user_src, src, off, n);
+    off += tot;
+  } else {
+    for(tot=0; tot<n; tot+=m, off+=m, src+=m){
+      if((addr = bmap(ip, off/BSIZE, 1)) == 0)
+        break;
+      m = min(n - tot, BSIZE - off%BSIZE);
+      // a whole block needs no read of what it replaces
+      bp = m == BSIZE ? bnew(ip->dev, addr) : bread(ip->dev, addr);
+      if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
+        brelse(bp);
+        break;
+      }
+      bp->valid = 1;
+      dwrite(bp);
       brelse(bp);
-      break;
     }
-    if(logstate_get() == 1)
-    log_write(bp);
-    else 
-    bwrite(bp);//log_write(bp);
-    brelse(bp);
   }
 
-  if(off > ip->size)
-    ip->size = off;
-
-  // write the i-node back to disk even if the size didn't change
-  // because the loop above might have called bmap() and added a new
-  // block to ip->addrs[].
+  if(off > ip->size)
+    ip->size = off;
+
+  // write the i-node back to disk if the size changed or the loop
+  // above called bmap() and changed ip->addrs[]. A change to mtime
+  // alone can wait.
+  if(ip->size != osize || ip->iflags != oflags ||
+     memcmp(ip->addrs, oaddrs, sizeof(oaddrs)) != 0)
+    iupdate(ip);
+  else
+    ip->dirty |= I_DIRTY_TIME;
+
+  return tot;
+}
+
+// Preallocate disk blocks for bytes [off, off+n) of extent-mapped
+// file ip as unwritten extents, so that later writes there find
+// their blocks contiguous and already allocated. Unless keep is
+// set, the file grows to off+n. Allocates at most one free run
+// per call, to stay within one transaction, and returns how many
+// bytes past off it has dealt with, or -1.
+// Caller must hold ip->lock, inside a transaction.
+int
+ifallocate(struct inode *ip, uint off, uint n, int keep)
+{
+  struct extent x;
+  uint bn, b1, end, goal, start, len, done, j;
+  int unwritten;
+
+  if(ip->type != T_FILE || !(ip->iflags & EXTENT_FL) || n == 0)
+    return -1;
+  if(off + n < off || off + n > MAXFILE*BSIZE)
+    return -1;
+  if((ip->iflags & INLINE_FL) && inline_migrate(ip) < 0)
+    return -1;
+
+  // skip what is mapped already, then take the hole after it
+  b1 = (off + n - 1) / BSIZE;
+  for(bn = off / BSIZE; bn <= b1 && ext_lookup(ip, bn, &unwritten); bn++)
+    ;
+  done = n;
+  if(bn <= b1){
+    for(end = bn + 1; end <= b1 && !ext_lookup(ip, end, &unwritten); end++)
+      ;
+    goal = bn > 0 ? ext_lookup(ip, bn - 1, &unwritten) : 0;
+    if(goal)
+      goal++;
+    if((start = brun(ip->dev, goal, end - bn, &len)) == 0 ||
+       (len = btake(ip->dev, start, len)) == 0)
+      return -1;
+    x.lblk = bn;
+    x.pblk = start;
+    x.len = len | EXT_UNWRITTEN;
+    if(ext_insert(ip, &x) < 0){
+      for(j = 0; j < len; j++)
+        bfree(ip->dev, start + j);
+      return -1;
+    }
+    if(bn + len <= b1)
+      done = (bn + len) * BSIZE - off;
+  }
+
+  if(!keep && off + done > ip->size)
+    ip->size = off + done;
   iupdate(ip);
-
-  return tot;
+  return done;
 }
 
 // Directories
@@ -737,6 +2434,15 @@ dirlink(struct inode *dp, char *name, uint inum)
 // 使用了新的目录结构体 dirent_vn，支持可变长度的目录名
 // 接口和原始函数保持一致，但需要增加 remove 接口
 // for root dir, just use original
+//
+// A vn directory is a whole number of blocks. The rec_len chain of
+// each block covers exactly BSIZE bytes, so no entry crosses a block
+// boundary and each block is walked in place in its buffer. An entry
+// with inum 0 is free space; removing any other entry folds it into
+// the rec_len of the one before it.
+
+// Bytes an entry with a name of len bytes needs, 4-byte aligned.
+#define VN_RECLEN(len) ((sizeof(struct dirent_vn) + (len) + 3) & ~3)
 
 int
 namecmp_vn(const char *s, const char *t, uint8 len)
@@ -744,153 +2450,242 @@ namecmp_vn(const char *s, const char *t, uint8 len)
   return strncmp(s, t, len);
 }
 
+// Read block lbn of vn directory dp; 0 if it has none.
+static struct buf*
+vn_block(struct inode *dp, uint lbn)
+{
+  uint addr;
+
+  if((addr = bmap(dp, lbn, 0)) == 0)
+    return 0;
+  return bread(dp->dev, addr);
+}
+
+static int
+vn_match(struct dirent_vn *de, char *name, uint8 n_len)
+{
+  return de->inum != 0 && de->name_len == n_len &&
+    namecmp_vn((char*)(de + 1), name, n_len) == 0;
+}
+
+// Look for name in dp. If found, set *poff to the entry's byte
+// offset and *lastpoff to that of the entry before it in the same
+// block, or to *poff if it is the first in its block.
 struct inode*
-dirlookup_vn(struct inode *dp, char *name, uint8 n_len, uint *poff, uint *lastpoff)// lastpoff should set 0
+dirlookup_vn(struct inode *dp, char *name, uint8 n_len, uint *poff, uint *lastpoff)
 {
-  struct dirent_vn de;
+  struct buf *bp;
+  struct dirent_vn *de;
+  uint lbn, off, prev, inum;
 
   if (dp->type == T_DIR)
     return dirlookup(dp, name, poff);
-  
+  if (dp->type == T_DXDIR)
+    return dirlookup_dx(dp, name, n_len, poff);
   if (dp->type != T_VNDIR)
-  {
     panic("dirlookup_vn not DIR");
-  }
 
-  //printf("dirlookup---dp=%d, size=%d,n_len=%d\n", dp->inum, dp->size, n_len);
-  uint32 off = 0;
-  while (off < dp->size)
-  {
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de)){
-      panic("dirlookup_vn readi");
-    }
-    
-    if(de.inum == 0){
-      off += de.rec_len;
+  for(lbn = 0; lbn < dp->size / BSIZE; lbn++){
+    if((bp = vn_block(dp, lbn)) == 0)
       continue;
-    }
-
-    char namebuf[NAME_MAX_LEN];
-    memset(namebuf, 0, sizeof(namebuf));
-    if(readi(dp, 0, (uint64)&namebuf, off + sizeof(de), de.name_len) != de.name_len){
-      panic("dirlookup_vn readi name");
-    }
-    //printf("off=%d,len=%d\n",off,de.name_len);
-    //printf("%s___%s\n", namebuf, name);
-    if(namecmp_vn(namebuf, name, n_len) == 0){
-      //printf("bingo\n");
-      if(poff)
-      {
-        *poff = off;
+    for(off = prev = 0; off < BSIZE; prev = off, off += de->rec_len){
+      de = (struct dirent_vn*)(bp->data + off);
+      if(de->rec_len == 0)
+        panic("dirlookup_vn rec_len");
+      if(vn_match(de, name, n_len)){
+        if(poff)
+          *poff = lbn * BSIZE + off;
+        if(lastpoff)
+          *lastpoff = lbn * BSIZE + prev;
+        inum = de->inum;
+        brelse(bp);
+        return iget(dp->dev, inum);
       }
-
-      return(iget(dp->dev, de.inum));
-    }
-    if(lastpoff)
-    {
-      *lastpoff = off;
     }
-    off += de.rec_len;
+    brelse(bp);
   }
-  //printf("ALIVE!!---n_len:%d\n", n_len);
   return 0;
 }
 
-int
-dirlink_vn(struct inode *dp, char *name, uint8 n_len, uint inum)
+// Add (name, inum) to vn directory dp in one pass over its blocks,
+// which both checks that name is absent and finds the first entry
+// with room to spare. The block holding that entry stays in its
+// buffer until the pass is over. Without room, dp grows a block.
+static int
+dirlink_vn1(struct inode *dp, char *name, uint8 n_len, uint inum, uint8 type)
 {
+  struct buf *bp, *slot;
+  struct dirent_vn *de, *nde;
+  uint lbn, off, soff, need, used;
 
-  if (dp->type == T_DIR){
+  if (dp->type == T_DIR)
     return dirlink(dp, name, inum);
+  if (dp->type == T_DXDIR){
+    struct inode *ip;
+    if((ip = dirlookup_dx(dp, name, n_len, 0)) != 0){
+      iput(ip);
+      return -1;
+    }
+    return dirlink_dx(dp, name, n_len, inum, type);
   }
 
-  struct dirent_vn de;
-  struct inode *ip;
-
-  // check
-  if((ip = dirlookup_vn(dp, name, n_len, 0, 0)) != 0){
-    iput(ip);
-    return -1;
-  }
-  // look for new
-  uint32 off = 0;
-  uint32 available_padding = 0;
-
-  while (off < dp->size)
-  {
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de)){
-      panic("dirlink_vn readi");
+  need = VN_RECLEN(n_len);
+  slot = 0;
+  soff = 0;
+  for(lbn = 0; lbn < dp->size / BSIZE; lbn++){
+    if((bp = vn_block(dp, lbn)) == 0)
+      continue;
+    for(off = 0; off < BSIZE; off += de->rec_len){
+      de = (struct dirent_vn*)(bp->data + off);
+      if(de->rec_len == 0)
+        panic("dirlink_vn rec_len");
+      if(vn_match(de, name, n_len)){
+        brelse(bp);
+        if(slot)
+          brelse(slot);
+        return -1;
+      }
+      used = de->inum ? VN_RECLEN(de->name_len) : 0;
+      if(slot == 0 && de->rec_len - used >= need){
+        slot = bp;
+        soff = off;
+      }
     }
-
-    if(de.inum == 0)
-      break;
-    available_padding = de.rec_len - sizeof(de) - de.name_len;
-    if(available_padding >= n_len)
-      break;
-
-    off += de.rec_len;
+    if(bp != slot)
+      brelse(bp);
   }
 
-  char namebuf[NAME_MAX_LEN];
-  memset(namebuf, 0, sizeof(namebuf));
-  memmove(namebuf, name, n_len);
-  if(off >= dp->size)
-  // new
-  {
-    de.inum = inum;
-    de.name_len = n_len;
-    de.rec_len = sizeof(de) + de.name_len;
-    //printf("dirlink,new---n_len=%d, rec_len=%d, off=%d, name=%s\n",de.name_len,de.rec_len, off, name);
-    if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink_vn write new");
-    if(writei(dp, 0, (uint64)&namebuf, off + sizeof(de), n_len) != n_len)
-      panic("dirlink_vn write new name");
+  if(slot == 0){
+    lbn = dp->size / BSIZE;
+    if((off = bmap(dp, lbn, 1)) == 0)
+      return -1;
+    slot = bread(dp->dev, off);
+    dp->size += BSIZE;
+    iupdate(dp);
+    de = (struct dirent_vn*)slot->data;
+    memset(de, 0, sizeof(*de));
+    de->rec_len = BSIZE;
+    soff = 0;
   }
-  else
-  // pad
-  {
-    struct dirent_vn newde;
-    newde.inum = inum;
-    newde.name_len = n_len;
-    newde.rec_len = available_padding;
-    de.rec_len -= available_padding;
-    //printf("dirlink,pad---------\n newde:inum:%d,n_len:%d,rec_len:%d\n",newde.inum, newde.name_len, newde.rec_len);
 
-    if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink_vn write pad old");
-    if(writei(dp, 0, (uint64)&newde, off + de.rec_len, sizeof(newde)) != sizeof(newde))
-      panic("dirlink_vn write pad");
-    if(writei(dp, 0, (uint64)&namebuf, off + de.rec_len, n_len) != n_len)
-      panic("dirlink_vn write pad name");
+  // Carve the new entry out of the spare tail of the one at soff,
+  // or take that entry over if it is free.
+  de = (struct dirent_vn*)(slot->data + soff);
+  if(de->inum == 0){
+    nde = de;
+  } else {
+    used = VN_RECLEN(de->name_len);
+    nde = (struct dirent_vn*)(slot->data + soff + used);
+    nde->rec_len = de->rec_len - used;
+    de->rec_len = used;
   }
+  nde->inum = inum;
+  nde->name_len = n_len;
+  nde->file_type = type;
+  memmove(nde + 1, name, n_len);
+  mwrite(slot);
+  brelse(slot);
   return 0;
 }
 
-int
-rmdir_vn(struct inode* dp, uint off, uint lastoff)
+// Remove the entry at off, with lastoff as set by dirlookup_vn().
+static int
+rmdir_vn1(struct inode* dp, uint off, uint lastoff)
 {
-  struct dirent_vn de;
-  struct dirent_vn lastde;
+  struct buf *bp;
+  struct dirent_vn *de, *prev;
+
   if(dp->type == T_DIR)
   {
+    struct dirent de;
     memset(&de, 0, sizeof(de));
     if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("unlink: writei");
     return 0;
   }
-  
-  if(readi(dp, 0, (uint64)&de, off, sizeof(de))!= sizeof(de))
-    panic("1111");
-  if(readi(dp, 0, (uint64)&lastde, lastoff, sizeof(de))!= sizeof(de))
-    panic("2222");
+  if(dp->type == T_DXDIR)
+    return rmdir_dx(dp, off);
+
+  if(off / BSIZE != lastoff / BSIZE || (bp = vn_block(dp, off / BSIZE)) == 0)
+    panic("rmdir_vn");
+  de = (struct dirent_vn*)(bp->data + off % BSIZE);
+  if(off == lastoff){
+    de->inum = 0;   // first in its block: keep it as free space
+  } else {
+    prev = (struct dirent_vn*)(bp->data + lastoff % BSIZE);
+    prev->rec_len += de->rec_len;
+  }
+  mwrite(bp);
+  brelse(bp);
+  return 0;
+}
+
+// Copy the name of the entry at off in dp into name, which must
+// have room for DXNAMESIZ bytes, set *inum, and return the name's
+// full length.
+static int
+dirent_name(struct inode *dp, uint off, char *name, uint *inum)
+{
+  struct dirent de;
+  struct dirent_vn vde;
+  struct dirent_dx xde;
+  int len;
 
-  uint rec_len = de.rec_len;
-  lastde.rec_len += rec_len;
-  if(writei(dp, 0, (uint64)&lastde, lastoff, sizeof(lastde))!= sizeof(lastde))
-    panic("33333");
+  switch(dp->type){
+  case T_DIR:
+    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+      panic("dirent_name");
+    for(len = 0; len < DIRSIZ && de.name[len]; len++)
+      ;
+    memmove(name, de.name, len);
+    *inum = de.inum;
+    return len;
+  case T_VNDIR:
+    if(readi(dp, 0, (uint64)&vde, off, sizeof(vde)) != sizeof(vde))
+      panic("dirent_name");
+    len = vde.name_len < DXNAMESIZ ? vde.name_len : DXNAMESIZ;
+    if(readi(dp, 0, (uint64)name, off + sizeof(vde), len) != len)
+      panic("dirent_name");
+    *inum = vde.inum;
+    return vde.name_len;
+  case T_DXDIR:
+    if(readi(dp, 0, (uint64)&xde, off, sizeof(xde)) != sizeof(xde))
+      panic("dirent_name");
+    memmove(name, xde.name, xde.name_len);
+    *inum = xde.inum;
+    return xde.name_len;
+  }
+  panic("dirent_name: not DIR");
+}
 
+// Add (name, inum) to dp, the dentry cache and the filename
+// index. type is the inode's type, which vn and indexed
+// directories keep in the entry.
+// Caller must hold dp->lock.
+int
+dirlink_vn(struct inode *dp, char *name, uint8 n_len, uint inum, uint8 type)
+{
+  if(dirlink_vn1(dp, name, n_len, inum, type) < 0)
+    return -1;
+  dcache_enter(dp->dev, dp->inum, name, n_len, inum);
+  nidx_add(dp->dev, dp->inum, name, n_len, inum);
   return 0;
+}
 
+// Remove the entry at off from dp, the dentry cache and the
+// filename index, dirtying at most RMDIRBLOCKS blocks.
+// Caller must hold dp->lock.
+int
+rmdir_vn(struct inode *dp, uint off, uint lastoff)
+{
+  char name[DXNAMESIZ];
+  uint inum;
+  int len;
+
+  len = dirent_name(dp, off, name, &inum);
+  dcache_forget(dp->dev, dp->inum, name, len);
+  nidx_del(dp->dev, dp->inum, name, len, inum);
+  return rmdir_vn1(dp, off, lastoff);
 }
 
 
@@ -900,32 +2695,407 @@ rmdir_vn(struct inode* dp, uint off, uint lastoff)
 // 使用了新的目录结构体 dirent_dx
 // 接口和原始函数保持一致，但需要增加 remove 接口，上一部分同理
 //
+// Block 0 of the directory holds the index, the rest are leaves.
+// A name's murmur3 hash picks one index entry by binary search,
+// so a lookup reads the index and one leaf. A full leaf is split
+// at its median hash into a new leaf appended to the directory.
+// Directory blocks are metadata and are written with mwrite().
+
+#define DX_INDEX(bp) ((struct index_dx*)((bp)->data + sizeof(struct meta_dx)))
+#define DX_DIRENT(bp) ((struct dirent_dx*)((bp)->data + sizeof(struct meta_dx)))
+
+static uint32
+dx_hash(char *name, uint8 n_len)
+{
+  return murmur3_32((uint8*)name, n_len, HASH_SEED_DX);
+}
+
+// Index of the entry in the index block bp that covers hash.
+static int
+dx_find(struct buf *bp, uint32 hash)
+{
+  struct index_dx *x = DX_INDEX(bp);
+  int lo, hi, mid;
+
+  lo = 0;
+  hi = ((struct meta_dx*)bp->data)->count - 1;
+  while(lo < hi){
+    mid = (lo + hi + 1) / 2;
+    if(x[mid].hash <= hash)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return lo;
+}
+
+// Add block lbn to dp, zeroed, and return its buffer.
+static struct buf*
+dx_grow(struct inode *dp)
+{
+  uint lbn, addr;
 
+  lbn = dp->size / BSIZE;
+  if((addr = bmap(dp, lbn, 1)) == 0)
+    return 0;
+  dp->size += BSIZE;
+  iupdate(dp);
+  return bread(dp->dev, addr);
+}
+
+// Give an empty directory its index and first leaf.
+static int
+dx_init(struct inode *dp)
+{
+  struct buf *ib, *lb;
 
+  if((ib = dx_grow(dp)) == 0)
+    return -1;
+  if((lb = dx_grow(dp)) == 0){
+    brelse(ib);
+    return -1;
+  }
+  ((struct meta_dx*)ib->data)->count = 1;
+  DX_INDEX(ib)[0].hash = 0;
+  DX_INDEX(ib)[0].block = 1;
+  mwrite(ib);
+  mwrite(lb);
+  brelse(lb);
+  brelse(ib);
+  return 0;
+}
 
-/*
 struct inode*
 dirlookup_dx(struct inode *dp, char *name, uint8 n_len, uint *poff)
 {
-  uint inum;
-  struct meta_dx meta;
-  struct dirent_dx de;
+  struct buf *bp;
+  struct dirent_dx *de;
+  uint32 hash;
+  uint lbn, inum;
+  int i, n;
 
-  if(dp->type != T_DIR)
+  if(dp->type != T_DXDIR)
     panic("dirlookup_dx not DIR");
+  if(dp->size == 0)
+    return 0;
+  if(n_len > DXNAMESIZ)
+    return 0;
 
-  uint32 hashcode = murmur3_32(name, n_len, 14);
-  uint32 blockn = 1;
-  while (1)
-  {
-    
+  hash = dx_hash(name, n_len);
+  bp = bread(dp->dev, bmap(dp, 0, 0));
+  lbn = DX_INDEX(bp)[dx_find(bp, hash)].block;
+  brelse(bp);
+
+  bp = bread(dp->dev, bmap(dp, lbn, 0));
+  n = ((struct meta_dx*)bp->data)->count;
+  de = DX_DIRENT(bp);
+  for(i = 0; i < n; i++){
+    if(de[i].hash == hash && de[i].name_len == n_len &&
+       namecmp_vn(de[i].name, name, n_len) == 0){
+      if(poff)
+        *poff = lbn * BSIZE + ((char*)&de[i] - (char*)bp->data);
+      inum = de[i].inum;
+      brelse(bp);
+      return iget(dp->dev, inum);
+    }
   }
-  
+  brelse(bp);
+  return 0;
+}
+
+// Move the upper half of full leaf lb, by hash, into a new leaf
+// and add it to the index ib after entry i. Returns the new
+// leaf's buffer, or 0 if the leaf cannot be split.
+static struct buf*
+dx_split(struct inode *dp, struct buf *ib, int i, struct buf *lb)
+{
+  struct meta_dx *im = (struct meta_dx*)ib->data;
+  struct meta_dx *lm = (struct meta_dx*)lb->data;
+  struct meta_dx *nm;
+  struct dirent_dx *le = DX_DIRENT(lb);
+  struct buf *nb;
+  uint32 h[NDIRENT_DX], m, t;
+  int j, k, n;
+
+  if(im->count >= NINDEX_DX)
+    return 0;
+
+  // median hash, but never the smallest one, so that
+  // the lower half keeps at least one hash value
+  n = lm->count;
+  for(j = 0; j < n; j++){
+    t = le[j].hash;
+    for(k = j; k > 0 && h[k-1] > t; k--)
+      h[k] = h[k-1];
+    h[k] = t;
+  }
+  for(k = n / 2; k < n && h[k] == h[0]; k++)
+    ;
+  if(k == n)
+    return 0;   // every name has the same hash
+  m = h[k];
+
+  if((nb = dx_grow(dp)) == 0)
+    return 0;
+  nm = (struct meta_dx*)nb->data;
+  for(j = 0, k = 0; j < n; j++){
+    if(le[j].hash >= m)
+      DX_DIRENT(nb)[nm->count++] = le[j];
+    else
+      le[k++] = le[j];
+  }
+  lm->count = k;
+
+  memmove(&DX_INDEX(ib)[i+2], &DX_INDEX(ib)[i+1],
+          (im->count - i - 1) * sizeof(struct index_dx));
+  DX_INDEX(ib)[i+1].hash = m;
+  DX_INDEX(ib)[i+1].block = dp->size / BSIZE - 1;
+  im->count++;
+  mwrite(ib);
+  return nb;
+}
+
+// Add (name, inum) to dp, which must not contain name.
+// type is the inode's type, kept in the entry for readers.
+int
+dirlink_dx(struct inode *dp, char *name, uint8 n_len, uint inum, uint8 type)
+{
+  struct buf *ib, *lb, *nb;
+  struct dirent_dx *de;
+  uint32 hash;
+  int i;
+
+  if(n_len > DXNAMESIZ)
+    return -1;    // does not fit a dirent_dx
+  if(dp->size == 0 && dx_init(dp) < 0)
+    return -1;
 
+  hash = dx_hash(name, n_len);
+  ib = bread(dp->dev, bmap(dp, 0, 0));
+  i = dx_find(ib, hash);
+  lb = bread(dp->dev, bmap(dp, DX_INDEX(ib)[i].block, 0));
+  if(((struct meta_dx*)lb->data)->count >= NDIRENT_DX){
+    if((nb = dx_split(dp, ib, i, lb)) == 0){
+      brelse(lb);
+      brelse(ib);
+      return -1;
+    }
+    mwrite(lb);
+    if(hash >= DX_INDEX(ib)[i+1].hash){
+      brelse(lb);
+      lb = nb;
+    } else {
+      mwrite(nb);
+      brelse(nb);
+    }
+  }
+  brelse(ib);
+
+  de = &DX_DIRENT(lb)[((struct meta_dx*)lb->data)->count++];
+  memset(de, 0, sizeof(*de));
+  de->inum = inum;
+  de->hash = hash;
+  de->name_len = n_len;
+  de->file_type = type;
+  memmove(de->name, name, n_len);
+  mwrite(lb);
+  brelse(lb);
   return 0;
 }
-*/
 
+// Remove the entry at byte offset off, as set by dirlookup_dx().
+int
+rmdir_dx(struct inode *dp, uint off)
+{
+  struct buf *bp;
+  struct meta_dx *m;
+  struct dirent_dx *de;
+  int i;
+
+  bp = bread(dp->dev, bmap(dp, off / BSIZE, 0));
+  m = (struct meta_dx*)bp->data;
+  de = DX_DIRENT(bp);
+  i = (off % BSIZE - sizeof(struct meta_dx)) / sizeof(struct dirent_dx);
+  if(i >= m->count)
+    panic("rmdir_dx");
+  de[i] = de[--m->count];   // order within a leaf does not matter
+  memset(&de[m->count], 0, sizeof(*de));
+  mwrite(bp);
+  brelse(bp);
+  return 0;
+}
+
+// Is directory dp empty except for "." and ".."?
+// Works for all directory types.
+int
+dirempty(struct inode *dp)
+{
+  struct dirent de;
+  struct dirent_vn vde;
+  struct buf *bp;
+  uint off, n;
+
+  switch(dp->type){
+  case T_DIR:
+    for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
+      if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirempty: readi");
+      if(de.inum != 0)
+        return 0;
+    }
+    return 1;
+  case T_VNDIR:
+    n = 0;
+    for(off = 0; off < dp->size; off += vde.rec_len){
+      if(readi(dp, 0, (uint64)&vde, off, sizeof(vde)) != sizeof(vde))
+        panic("dirempty: readi");
+      if(vde.inum != 0 && ++n > 2)
+        return 0;
+      if(vde.rec_len == 0)
+        break;
+    }
+    return 1;
+  case T_DXDIR:
+    n = 0;
+    for(off = BSIZE; off < dp->size; off += BSIZE){
+      bp = bread(dp->dev, bmap(dp, off / BSIZE, 0));
+      n += ((struct meta_dx*)bp->data)->count;
+      brelse(bp);
+    }
+    return n <= 2;
+  }
+  panic("dirempty: not DIR");
+}
+
+// Read the first entry of dp at or after byte offset *off into
+// name (NAME_MAX_LEN bytes, not NUL-terminated), *len, *inum and
+// *type (0 where the entry does not record it), skipping free
+// slots, and set *off to where the search for the next one should
+// resume. Returns 0 at the end of the directory.
+// Works for all directory types.
+// Caller must hold dp->lock.
+int
+dirnext(struct inode *dp, uint *off, char *name, uint8 *len, uint *inum,
+        uint8 *type)
+{
+  struct dirent de;
+  struct dirent_vn *vde;
+  struct dirent_dx *xde;
+  struct meta_dx *m;
+  struct buf *bp;
+  uint i;
+
+  switch(dp->type){
+  case T_DIR:
+    for(; *off + sizeof(de) <= dp->size; *off += sizeof(de)){
+      if(readi(dp, 0, (uint64)&de, *off, sizeof(de)) != sizeof(de))
+        panic("dirnext: readi");
+      if(de.inum == 0)
+        continue;
+      *off += sizeof(de);
+      for(i = 0; i < DIRSIZ && de.name[i]; i++)
+        ;
+      memmove(name, de.name, i);
+      *len = i;
+      *inum = de.inum;
+      *type = 0;
+      return 1;
+    }
+    return 0;
+  case T_VNDIR:
+    while(*off < dp->size){
+      if((bp = vn_block(dp, *off / BSIZE)) == 0){
+        *off = (*off / BSIZE + 1) * BSIZE;
+        continue;
+      }
+      vde = (struct dirent_vn*)(bp->data + *off % BSIZE);
+      if(vde->rec_len == 0)
+        panic("dirnext rec_len");
+      *off += vde->rec_len;
+      if(vde->inum != 0){
+        memmove(name, (char*)(vde + 1), vde->name_len);
+        *len = vde->name_len;
+        *inum = vde->inum;
+        *type = vde->file_type;
+        brelse(bp);
+        return 1;
+      }
+      brelse(bp);
+    }
+    return 0;
+  case T_DXDIR:
+    if(*off < BSIZE)
+      *off = BSIZE;   // skip the index
+    while(*off < dp->size){
+      if(*off % BSIZE < sizeof(struct meta_dx))
+        *off += sizeof(struct meta_dx) - *off % BSIZE;
+      bp = bread(dp->dev, bmap(dp, *off / BSIZE, 0));
+      m = (struct meta_dx*)bp->data;
+      i = (*off % BSIZE - sizeof(struct meta_dx)) / sizeof(struct dirent_dx);
+      if(i < m->count){
+        xde = &DX_DIRENT(bp)[i];
+        *off += sizeof(struct dirent_dx);
+        memmove(name, xde->name, xde->name_len);
+        *len = xde->name_len;
+        *inum = xde->inum;
+        *type = xde->file_type;
+        brelse(bp);
+        return 1;
+      }
+      brelse(bp);
+      *off = (*off / BSIZE + 1) * BSIZE;
+    }
+    return 0;
+  }
+  panic("dirnext: not DIR");
+}
+
+// Fill dst, n bytes long, with struct dirent_plus records for the
+// entries of dp from byte offset *off on, and advance *off past
+// them. With stat set, each record's type and size come from the
+// on-disk inode, read through its block without locking the inode,
+// which keeps ".." free of lock-order trouble and needs no iget().
+// Returns the bytes filled, 0 at the end of the directory, or -1
+// if the next entry does not fit in n bytes at all.
+// Caller must hold dp->lock.
+int
+dirread(struct inode *dp, uint *off, char *dst, int n, int stat)
+{
+  struct dirent_plus *d;
+  struct dinode *dip;
+  struct buf *bp;
+  char name[NAME_MAX_LEN];
+  uint8 len, type;
+  uint next, inum;
+  int tot, rec;
+
+  tot = 0;
+  next = *off;
+  while(dirnext(dp, &next, name, &len, &inum, &type)){
+    rec = DENT_RECLEN(len);
+    if(tot + rec > n)
+      return tot > 0 ? tot : -1;
+    d = (struct dirent_plus*)(dst + tot);
+    d->ino = inum;
+    d->reclen = rec;
+    d->namelen = len;
+    d->type = type;
+    d->size = 0;
+    if(stat){
+      bp = bread(dp->dev, IBLOCK(inum, sb));
+      dip = (struct dinode*)bp->data + inum%IPB;
+      d->type = dip->type;
+      d->size = dip->size;
+      brelse(bp);
+    }
+    memmove(d + 1, name, len);
+    ((char*)(d + 1))[len] = 0;
+    tot += rec;
+    *off = next;
+  }
+  *off = next;
+  return tot;
+}
 
 
 // Paths
@@ -1058,8 +3228,8 @@ skipelem_vn(char *path, char *name, uint8 *n_len)
     path++;
   len = path - s;
   *n_len = len;
-  if(len >= DIRSIZ)
-    memmove(name, s, DIRSIZ);
+  if(len >= DXNAMESIZ)
+    memmove(name, s, DXNAMESIZ);
   else {
     memmove(name, s, len);
     name[len] = 0;
@@ -1074,6 +3244,7 @@ namex_vn(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
   uint8 n_len;
+  uint inum;
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
@@ -1082,7 +3253,7 @@ namex_vn(char *path, int nameiparent, char *name)
   while((path = skipelem_vn(path, name, &n_len)) != 0){
     //printf("ip=%d, path=%s,name=%s, n_len=%d\n",ip->inum, path, name, n_len);
     ilock(ip);
-    if(ip->type != T_DIR && ip->type != T_VNDIR){
+    if(!ISDIR(ip->type)){
       iunlockput(ip);
       return 0;
     }
@@ -1092,10 +3263,18 @@ namex_vn(char *path, int nameiparent, char *name)
       return ip;
     }
     
-    if((next = dirlookup_vn(ip, name, n_len, 0, 0)) == 0){
+    if(dcache_lookup(ip->dev, ip->inum, name, n_len, &inum)){
+      if(inum == 0){
+        iunlockput(ip);
+        return 0;
+      }
+      next = iget(ip->dev, inum);
+    } else if((next = dirlookup_vn(ip, name, n_len, 0, 0)) == 0){
+      dcache_enter(ip->dev, ip->inum, name, n_len, 0);
       iunlockput(ip);
       return 0;
-    }
+    } else
+      dcache_enter(ip->dev, ip->inum, name, n_len, next->inum);
     //printf("qwqwq\n");
     iunlockput(ip);
     ip = next;
@@ -1110,7 +3289,7 @@ namex_vn(char *path, int nameiparent, char *name)
 struct inode*
 namei_vn(char *path)
 {
-  char name[DIRSIZ];
+  char name[DXNAMESIZ];
   return namex_vn(path, 0, name);
 }
 
@@ -1118,4 +3297,231 @@ struct inode*
 nameiparent_vn(char *path, char *name)
 {
   return namex_vn(path, 1, name);
-}
\ No newline at end of file
+}
+
+// Filename index, laid out as fs.h describes.
+// dirlink_vn() and rmdir_vn() keep it in step with the
+// directories, in the caller's transaction.
+
+#define NIDXCAND 16   // matches taken from one index block
+
+static uint
+nidx_hash(char *name, uint8 len)
+{
+  return murmur3_32((uint8*)name, len < DIRSIZ ? len : DIRSIZ, NIDX_SEED);
+}
+
+static int
+isdots(char *name, uint8 len)
+{
+  return (len == 1 && name[0] == '.') ||
+         (len == 2 && name[0] == '.' && name[1] == '.');
+}
+
+// Record that directory dir links name to inum.
+void
+nidx_add(uint dev, uint dir, char *name, uint8 len, uint inum)
+{
+  struct buf *bp;
+  struct nidx_head *h;
+  struct nidx_ent *e;
+  uint hash, i;
+
+  if(sb.nidxstart == 0 || sb.nidxlost || isdots(name, len))
+    return;
+  hash = nidx_hash(name, len);
+  for(i = 0; i < NIDXPROBE && i < sb.nnidx; i++){
+    bp = bread(dev, sb.nidxstart + (hash + i) % sb.nnidx);
+    h = (struct nidx_head*)bp->data;
+    if(h->count < NIDXENT){
+      e = (struct nidx_ent*)(h + 1) + h->count++;
+      e->hash = hash;
+      e->dir = dir;
+      e->inum = inum;
+      mwrite(bp);
+      brelse(bp);
+      return;
+    }
+    if(!h->overflow){
+      h->overflow = 1;
+      mwrite(bp);
+    }
+    brelse(bp);
+  }
+  sb.nidxlost = 1;
+  writesb(dev);
+}
+
+// Forget that directory dir links name to inum.
+void
+nidx_del(uint dev, uint dir, char *name, uint8 len, uint inum)
+{
+  struct buf *bp;
+  struct nidx_head *h;
+  struct nidx_ent *e;
+  uint hash, i, j, more;
+
+  if(sb.nidxstart == 0 || sb.nidxlost || isdots(name, len))
+    return;
+  hash = nidx_hash(name, len);
+  for(i = 0; i < sb.nnidx; i++){
+    bp = bread(dev, sb.nidxstart + (hash + i) % sb.nnidx);
+    h = (struct nidx_head*)bp->data;
+    e = (struct nidx_ent*)(h + 1);
+    for(j = 0; j < h->count; j++){
+      if(e[j].hash == hash && e[j].dir == dir && e[j].inum == inum){
+        e[j] = e[--h->count];
+        memset(&e[h->count], 0, sizeof(e[0]));
+        mwrite(bp);
+        brelse(bp);
+        return;
+      }
+    }
+    more = h->overflow;
+    brelse(bp);
+    if(!more)
+      return;
+  }
+}
+
+// Put "/" and the len bytes of name in front of *p, which must
+// stay at or after start.
+static int
+prepend(char **p, char *start, char *name, int len)
+{
+  if(*p - start < len + 1)
+    return -1;
+  *p -= len;
+  memmove(*p, name, len);
+  *--*p = '/';
+  return 0;
+}
+
+// Write into path, n bytes long, the absolute path of name in
+// directory dp if it still links inum, and return its length;
+// return -1 if it does not, or if the path does not fit.
+// Locks one directory at a time, going up by "..": a locked child
+// that is still linked keeps its parent from being freed while
+// dirlookup_vn() takes a reference to it.
+// The caller holds a reference to dp, and must not hold dp->lock.
+static int
+entpath(struct inode *dp, char *name, uint8 len, uint inum, char *path, int n)
+{
+  struct inode *ip, *pp;
+  char comp[NAME_MAX_LEN];
+  uint8 clen, type;
+  uint pos, cinum;
+  char *p;
+  int ok;
+
+  p = path + n;
+  *--p = '\0';
+  if(prepend(&p, path, name, len) < 0)
+    return -1;
+
+  begin_op();
+  ilock(dp);
+  ip = dirlookup_vn(dp, name, len, 0, 0);
+  iunlock(dp);
+  ok = ip != 0 && ip->inum == inum;
+  if(ip)
+    iput(ip);
+  end_op();
+  if(!ok)
+    return -1;
+
+  idup(dp);
+  for(;;){
+    begin_op();
+    ilock(dp);
+    if(dp->inum == ROOTINO){
+      iunlockput(dp);
+      end_op();
+      break;
+    }
+    pp = dp->nlink > 0 ? dirlookup_vn(dp, "..", 2, 0, 0) : 0;
+    iunlock(dp);
+    if(pp == 0){
+      iput(dp);
+      end_op();
+      return -1;
+    }
+    ilock(pp);
+    ok = 0;
+    for(pos = 0; dirnext(pp, &pos, comp, &clen, &cinum, &type); ){
+      if(cinum == dp->inum && !isdots(comp, clen)){
+        ok = 1;
+        break;
+      }
+    }
+    iunlock(pp);
+    iput(dp);
+    end_op();
+    if(!ok || prepend(&p, path, comp, clen) < 0){
+      begin_op();
+      iput(pp);
+      end_op();
+      return -1;
+    }
+    dp = pp;
+  }
+  memmove(path, p, path + n - p);
+  return path + n - p - 1;
+}
+
+// Fill out, n bytes long, with the NUL-terminated absolute paths
+// of the entries called name, as many as fit. Returns the bytes
+// used, or -1 if the file system has no filename index or it
+// misses names. Must not be called inside a transaction.
+int
+nidx_search(char *name, uint8 len, char *out, int n)
+{
+  struct buf *bp;
+  struct nidx_head *h;
+  struct nidx_ent *e;
+  struct inode *cand[NIDXCAND];
+  uint inums[NIDXCAND];
+  char path[MAXPATH];
+  uint hash, i, j, k, nc, more, left;
+  int r, tot;
+
+  if(sb.nidxstart == 0 || sb.nidxlost)
+    return -1;
+  hash = nidx_hash(name, len);
+  tot = 0;
+  for(i = 0; i < sb.nnidx; i++){
+    // take references to the directories under the block's lock,
+    // which keeps their entries, and so them, from going away;
+    // NIDXCAND at a time, going back for the rest from entry j.
+    j = 0;
+    do {
+      bp = bread(ROOTDEV, sb.nidxstart + (hash + i) % sb.nnidx);
+      h = (struct nidx_head*)bp->data;
+      e = (struct nidx_ent*)(h + 1);
+      nc = 0;
+      for(; j < h->count && nc < NIDXCAND; j++){
+        if(e[j].hash == hash){
+          cand[nc] = iget(ROOTDEV, e[j].dir);
+          inums[nc++] = e[j].inum;
+        }
+      }
+      more = h->overflow;
+      left = j < h->count;
+      brelse(bp);
+
+      for(k = 0; k < nc; k++){
+        r = entpath(cand[k], name, len, inums[k], path, sizeof(path));
+        if(r > 0 && tot + r + 1 <= n){
+          memmove(out + tot, path, r + 1);
+          tot += r + 1;
+        }
+        begin_op();
+        iput(cand[k]);
+        end_op();
+      }
+    } while(left);
+    if(!more)
+      break;
+  }
+  return tot;
+}
@@ -9,6 +9,9 @@
 // [ boot block | super block | log | inode blocks |
 //                                          free bit map | data blocks]
 //
+// With an external journal (logdev != 0) the log is left out of this
+// layout and lives on device logdev, starting at block logstart there.
+//
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
 struct superblock {
@@ -20,7 +23,13 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
-  uint reserved[20];
+  uint logdev;       // Device holding the log, 0 if this device
+  uint imapstart;    // Block number of first inode map block, 0 if none
+  uint orphan;       // First inode on the orphan list, 0 if none
+  uint nidxstart;    // Block number of first name index block, 0 if none
+  uint nnidx;        // Number of name index blocks
+  uint nidxlost;     // Name index missed a name and is not used
+  uint reserved[14];
 };
 
 #define FSMAGIC 0x10203040
@@ -46,7 +55,8 @@ struct dinode {
   uint iflags;            // flag
   uint32 generation;      // indicate the file version
   uint32 gid;             // group id
-  uint osd_2[7];          // OS dependant structure in EXT, be blank here
+  uint next_orphan;       // next inode on the orphan list, see fs.c
+  uint osd_2[6];          // OS dependant structure in EXT, be blank here
 };
 
 // iflags values
@@ -58,6 +68,52 @@ struct dinode {
 #define APPEND_FL       0x00000020    // Append Only
 #define NODUMP_FL       0x00000040    // Do No Dump/Delete
 #define NOATIME_FL      0x00000080    // Do Not Update .i_atime
+#define EXTENT_FL       0x00000100    // blocks mapped by extents
+#define INLINE_FL       0x10000000    // data stored in addrs[]
+
+// Compressed inodes (COMPR_FL) store data in clusters of CLUSTER
+// blocks, each compressed on its own; see fs.c. A cluster is
+// staged in one page, so CSIZE must equal PGSIZE.
+#define CLUSTER 4
+#define CSIZE   (CLUSTER*BSIZE)
+
+// atimeswitch() modes: when a read updates an inode's atime.
+// Files with NOATIME_FL never have it updated.
+#define ATIME_STRICT    0   // every read
+#define ATIME_RELATIME  1   // atime not after mtime/ctime, or a day old
+#define ATIME_NOATIME   2   // never
+
+// Inline inodes (INLINE_FL) keep up to NINLINE bytes of data in
+// addrs[] and own no blocks. New files start inline and move to a
+// data block, in whatever format EXTENT_FL selects, when they grow
+// past NINLINE. The kernel alone sets and clears the flag.
+#define NINLINE (sizeof(uint)*(NDIRECT+3))
+
+// Extent-mapped inodes (EXTENT_FL) use addrs[] as the root of an
+// extent tree instead of direct and indirect pointers: an ext_header
+// followed by NEXT_ROOT entries, sorted by logical block.
+// At depth 0 the entries are extents. At depth 1 they index leaf
+// blocks: lblk is the first logical block the leaf covers and pblk
+// the leaf's block number. A leaf is an ext_header followed by up
+// to NEXT_LEAF extents.
+struct ext_header {
+  ushort n;             // entries in use
+  ushort depth;         // 0: entries are extents, 1: leaf indexes
+};
+
+struct extent {
+  uint lblk;            // first logical block
+  uint pblk;            // first disk block
+  uint len;             // number of blocks, | EXT_UNWRITTEN
+};
+
+// An unwritten extent's blocks are allocated but hold no data yet:
+// they read as zeros, and are zeroed when first written.
+#define EXT_UNWRITTEN   0x80000000
+#define EXT_LEN(e)      ((e)->len & ~EXT_UNWRITTEN)
+
+#define NEXT_ROOT ((sizeof(uint)*(NDIRECT+3) - sizeof(struct ext_header)) / sizeof(struct extent))
+#define NEXT_LEAF ((BSIZE - sizeof(struct ext_header)) / sizeof(struct extent))
 
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
@@ -68,6 +124,9 @@ struct dinode {
 // Bitmap bits per block
 #define BPB           (BSIZE*8)
 
+// Block of inode map containing bit for inode i
+#define IMBLOCK(i, sb) ((i)/BPB + sb.imapstart)
+
 // Block of free map containing bit for block b
 #define BBLOCK(b, sb) ((b)/BPB + sb.bmapstart)
 
@@ -95,21 +154,72 @@ struct dirent_vn
 
 // Indexed Directory
 // hash 索引检索目录
-// 
-// 每一个区中的结构
+//
+// 第 0 块是索引，按 hash 升序排列，第 i 项覆盖 [hash_i, hash_i+1)
+// [ meta_dx | index_dx | ... | index_dx ]
+// 其余每一块是叶子
 // [ meta_dx | dirent_dx | ... | dirent_dx ]
 struct meta_dx
 {
-  uint8 count;    // 1 byte
-  uint32 max;     // 4 bytes
-  uint32 min;     // 4 bytes
+  uint32 count;   // 4 bytes, entries in this block
+};
+
+struct index_dx
+{
+  uint32 hash;    // 4 bytes, smallest hash in the leaf
+  uint32 block;   // 4 bytes, leaf's block number in the directory
 };
 
+#define DXNAMESIZ 22
+
 struct dirent_dx
 {
   uint32 inum;    // 4 bytes
   uint32 hash;    // 4 bytes
-  char name_pre[4]; // 4 bytes
+  uint8 name_len;   // 1 byte
+  uint8 file_type;  // 1 byte
+  char name[DXNAMESIZ]; // 22 bytes
+};
+
+#define NINDEX_DX ((BSIZE - sizeof(struct meta_dx)) / sizeof(struct index_dx))
+#define NDIRENT_DX ((BSIZE - sizeof(struct meta_dx)) / sizeof(struct dirent_dx))
+#define HASH_SEED_DX 14
+
+// Any of the three directory types.
+#define ISDIR(t) ((t) == T_DIR || (t) == T_VNDIR || (t) == T_DXDIR)
+
+// Filename index
+//
+// A hash table from names to the (directory, inode) pairs that
+// link them, kept in sb.nnidx blocks from sb.nidxstart on. The
+// hash of a name's first DIRSIZ bytes picks its home block. An
+// entry goes in the first block from home on with room, and each
+// full block it passes is marked overflowed, so a search moves on
+// past a block only if it is marked. "." and ".." are not indexed.
+// A name that finds no room sets sb.nidxlost, and from then on the
+// index is neither kept nor searched.
+struct nidx_head {
+  uint count;       // entries in use, packed at the start
+  uint overflow;    // some entry homed here lives further on
+};
+
+struct nidx_ent {
+  uint hash;
+  uint dir;         // inode number of the directory
+  uint inum;
 };
 
-#define HASH_SIZE_PER_MT 256
\ No newline at end of file
+#define NIDXENT ((BSIZE - sizeof(struct nidx_head)) / sizeof(struct nidx_ent))
+#define NIDX_SEED 31
+#define NIDXPROBE 2   // blocks an insertion tries, to bound its writes
+
+// Blocks rmdir_vn() may dirty: the directory block holding the
+// entry, and the name index block holding its index entry.
+// Transaction budgets count on this; keep it in step.
+#define RMDIRBLOCKS 2
+
+// Blocks dirlink_vn() may dirty: splitting a full indexed
+// directory leaf writes the index block, both leaves, and the new
+// leaf's bitmap, indirect and inode blocks; then come NIDXPROBE
+// name index blocks, and the super block if the name misses.
+#define LINKBLOCKS (6+NIDXPROBE+1)
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "types.h"
+#include "riscv.h"
 #include "defs.h"
 
 static inline uint32 murmur_32_scramble(uint32 k) {
@@ -15,7 +16,7 @@ uint32 murmur3_32(const uint8* key, uint16 len, uint32 seed)
     for (uint16 i = len >> 2; i; i--) {
         // Here is a source of differing results across endiannesses.
         // A swap here has no effects on hash properties though.
-        memcpy(&k, key, sizeof(uint32));
+        memmove(&k, key, sizeof(uint32));
         key += sizeof(uint32);
         h ^= murmur_32_scramble(k);
         h = (h << 13) | (h >> 19);
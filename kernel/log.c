@@ -6,6 +6,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "logstat.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -21,6 +22,13 @@
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
 //
+// Commits are grouped: the last outstanding end_op() commits
+// only if the log could not take another system call, or if
+// log_sync() asked for it. Otherwise the transaction stays open
+// and gathers later calls, and the logflush thread commits it
+// within COMMITTICKS ticks. fsync(), O_SYNC and SYNC_FL files
+// use log_sync() to wait for their updates to reach the disk.
+//
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
 //   header block, containing block #s for block A, B, C, ...
@@ -29,6 +37,11 @@
 //   block C
 //   ...
 // Log appends are synchronous.
+//
+// The log may live on a separate disk (superblock logdev), so that
+// log appends are sequential on their own device and never queue
+// behind data reads; block numbers in the header always refer to
+// the file system device.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -43,8 +56,14 @@ struct log {
   int size;
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
-  int dev;
+  int syncwant;    // log_sync() waits for the open transaction.
+  int ncommitted;  // transactions committed since boot.
+  int dev;         // device the logged blocks live on.
+  int logdev;      // device holding the log itself.
   struct logheader lh;
+  int txwrites;    // log_write() calls in the current transaction.
+  int txabsorbs;   // ... of which were absorbed.
+  struct logstat stat;  // protected by lock.
 };
 struct log log;
 
@@ -52,6 +71,22 @@ int logstate;
 
 static void recover_from_log(void);
 static void commit();
+static int log_block(uint);
+static void commit_and_wake(void);
+
+// the time CSR ticks at 10MHz on qemu's virt machine.
+#define TIME_PER_US 10
+
+// Add sample v to power-of-two histogram h.
+static void
+loghist(uint64 *h, uint64 v)
+{
+  int i;
+
+  for(i = 0; v != 0 && i < NLOGHIST-1; i++)
+    v >>= 1;
+  h[i]++;
+}
 
 void
 initlog(int dev, struct superblock *sb)
@@ -64,6 +99,12 @@ initlog(int dev, struct superblock *sb)
   log.start = sb->logstart;
   log.size = sb->nlog;
   log.dev = dev;
+  log.logdev = dev;
+  if(sb->logdev != 0){
+    if(sb->logdev != LOGDEV || !virtio_disk_present(LOGDEV))
+      panic("initlog: no log device");
+    log.logdev = sb->logdev;
+  }
   recover_from_log();
 }
 
@@ -74,12 +115,19 @@ install_trans(int recovering)
   int tail;
 
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
+    if(recovering == 0){
+      // the pinned cache block already holds what the log does
+      struct buf *dbuf = bread(log.dev, log.lh.block[tail]);
+      bwrite(dbuf);  // write dst to disk
+      bunpin(dbuf);
+      brelse(dbuf);
+      continue;
+    }
+    struct buf *lbuf = bread(log.logdev, log.start+tail+1); // read log block
+    struct buf *dbuf = bnew(log.dev, log.lh.block[tail]); // dst, overwritten
     memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
+    dbuf->valid = 1;
     bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
     brelse(lbuf);
     brelse(dbuf);
   }
@@ -89,7 +137,7 @@ install_trans(int recovering)
 static void
 read_head(void)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = bread(log.logdev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
   log.lh.n = lh->n;
@@ -105,7 +153,7 @@ read_head(void)
 static void
 write_head(void)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = bread(log.logdev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
   hb->n = log.lh.n;
@@ -129,17 +177,28 @@ recover_from_log(void)
 void
 begin_op(void)
 {
+  uint64 t0 = 0;
+
   if(logstate_get() != 0)
   {
   acquire(&log.lock);
+  log.stat.nbegin++;
   while(1){
     if(log.committing){
+      if(t0 == 0)
+        t0 = r_time();
       sleep(&log, &log.lock);
     } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
       // this op might exhaust log space; wait for commit.
+      if(t0 == 0)
+        t0 = r_time();
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      if(t0 != 0){
+        log.stat.nwait++;
+        loghist(log.stat.wait_us, (r_time() - t0) / TIME_PER_US);
+      }
       release(&log.lock);
       break;
     }
@@ -148,7 +207,9 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation
+// and the log is too full for another one, or a
+// log_sync() is waiting.
 void
 end_op(void)
 {
@@ -160,9 +221,11 @@ end_op(void)
   log.outstanding -= 1;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
+  if(log.outstanding == 0 &&
+     (log.syncwant || log.lh.n + MAXOPBLOCKS > LOGSIZE)){
     do_commit = 1;
     log.committing = 1;
+    log.syncwant = 0;
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
@@ -174,12 +237,70 @@ end_op(void)
   if(do_commit){
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
+    commit_and_wake();
+  }
+  }
+}
+
+// Commit with log.committing set, then let
+// begin_op() and log_sync() callers go on.
+static void
+commit_and_wake(void)
+{
+  commit();
+  acquire(&log.lock);
+  log.committing = 0;
+  log.ncommitted++;
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// Wait until the updates of every FS system call that has
+// already ended are on disk: commit the open transaction, or
+// wait for the commit under way. Must not be called between
+// begin_op() and end_op().
+void
+log_sync(void)
+{
+  int want;
+
+  if(logstate_get() == 0)
+    return;     // every write already went to disk
+  acquire(&log.lock);
+  if(!log.committing && log.lh.n == 0){
     release(&log.lock);
+    return;
   }
+  want = log.ncommitted + 1;
+  if(!log.committing){
+    if(log.outstanding == 0){
+      log.committing = 1;
+      release(&log.lock);
+      commit_and_wake();
+      return;
+    }
+    log.syncwant = 1;   // the last end_op() commits
+  }
+  while(log.ncommitted < want)
+    sleep(&log, &log.lock);
+  release(&log.lock);
+}
+
+// Body of the logflush kernel thread: commit the open
+// transaction every COMMITTICKS ticks, so that an update
+// reaches the disk soon even if nobody asks for it.
+void
+logflush(void)
+{
+  uint t0;
+
+  for(;;){
+    acquire(&tickslock);
+    t0 = ticks;
+    while(ticks - t0 < COMMITTICKS)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+    log_sync();
   }
 }
 
@@ -190,9 +311,10 @@ write_log(void)
   int tail;
 
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
+    struct buf *to = bnew(log.logdev, log.start+tail+1); // log block
     struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
     memmove(to->data, from->data, BSIZE);
+    to->valid = 1;
     bwrite(to);  // write the log
     brelse(from);
     brelse(to);
@@ -202,12 +324,28 @@ write_log(void)
 static void
 commit()
 {
+  uint64 t0;
+  int n;
+
   if (log.lh.n > 0) {
+    t0 = r_time();
+    n = log.lh.n;
+    bitmap_commit(); // Bring the bitmap blocks into the cache
     write_log();     // Write modified blocks from cache to log
     write_head();    // Write header to disk -- the real commit
     install_trans(0); // Now install writes to home locations
     log.lh.n = 0;
     write_head();    // Erase the transaction from the log
+
+    acquire(&log.lock);
+    log.stat.ncommit++;
+    loghist(log.stat.commit_us, (r_time() - t0) / TIME_PER_US);
+    loghist(log.stat.txblocks, n);
+    if(log.txwrites > 0)
+      log.stat.absorb[log.txabsorbs * 10 / log.txwrites]++;
+    log.txwrites = 0;
+    log.txabsorbs = 0;
+    release(&log.lock);
   }
 }
 
@@ -222,6 +360,24 @@ commit()
 //   brelse(bp)
 void
 log_write(struct buf *b)
+{
+  if (log_block(b->blockno))
+    bpin(b);
+}
+
+// Like log_write(), for a block whose contents only reach the
+// cache at commit: bitmap_commit() copies the in-memory bitmaps
+// in, and pins the buffers then.
+void
+log_defer(uint blockno)
+{
+  log_block(blockno);
+}
+
+// Enter blockno in the transaction. Returns 1 if it is new to
+// it, so the caller must pin its buffer.
+static int
+log_block(uint blockno)
 {
   int i;
 
@@ -232,20 +388,27 @@ log_write(struct buf *b)
     panic("log_write outside of trans");
 
   for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorption
+    if (log.lh.block[i] == blockno)   // log absorption
       break;
   }
-  log.lh.block[i] = b->blockno;
+  log.lh.block[i] = blockno;
+  log.stat.nlogwrite++;
+  log.txwrites++;
   if (i == log.lh.n) {  // Add new block to log?
-    bpin(b);
     log.lh.n++;
+    release(&log.lock);
+    return 1;
   }
+  log.stat.nabsorb++;
+  log.txabsorbs++;
   release(&log.lock);
+  return 0;
 }
 
 void
 switchs(int lstat)
 {
+  log_sync();   // leave no logged blocks behind
   logstate = lstat;
 }
 
@@ -253,4 +416,18 @@ int
 logstate_get(void)
 {
   return logstate;
-}
\ No newline at end of file
+}
+
+// Copy the journal statistics into *st.
+// If reset is set, start counting afresh.
+void
+logstat_get(struct logstat *st, int reset)
+{
+  acquire(&log.lock);
+  log.stat.mode = logstate;
+  log.stat.size = LOGSIZE;
+  *st = log.stat;
+  if(reset)
+    memset(&log.stat, 0, sizeof(log.stat));
+  release(&log.lock);
+}
@@ -0,0 +1,26 @@
+// Journal statistics, filled in by the logstat() system call.
+// Both the kernel and user programs use this header file.
+//
+// Histograms are bucketed by powers of two: bucket 0 counts
+// samples equal to 0, bucket i counts samples in [2^(i-1), 2^i),
+// and the last bucket also counts everything larger.
+// Absorption is bucketed by tens of percent: bucket i counts
+// transactions where i*10% .. i*10+9% of log_write()s were absorbed,
+// bucket 10 counts fully absorbed ones.
+
+#define NLOGHIST    16
+#define NABSORBHIST 11
+
+struct logstat {
+  int mode;                       // current logswitch mode
+  int size;                       // log blocks usable for data
+  uint64 nbegin;                  // begin_op() calls
+  uint64 nwait;                   // begin_op() calls that had to sleep
+  uint64 ncommit;                 // committed non-empty transactions
+  uint64 nlogwrite;               // log_write() calls
+  uint64 nabsorb;                 // log_write() calls absorbed
+  uint64 commit_us[NLOGHIST];     // commit() latency, microseconds
+  uint64 txblocks[NLOGHIST];      // blocks per committed transaction
+  uint64 wait_us[NLOGHIST];       // begin_op() sleep time, microseconds
+  uint64 absorb[NABSORBHIST];     // absorbed share of log_write()s
+};
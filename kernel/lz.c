@@ -0,0 +1,162 @@
+// LZ77 compression in the style of LZ4's block format,
+// used for the clusters of COMPR_FL files.
+//
+// Compressed data is a series of sequences. Each starts with a
+// token byte whose high nibble is the literal count and whose low
+// nibble is the match length minus LZ_MINMATCH. A nibble of 15
+// means extra length bytes follow, each added in, up to and
+// including the first one below 255. Then come the literals and a
+// 2-byte little-endian offset back to the match. The last sequence
+// has literals only and ends the data.
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+
+#define LZ_MINMATCH 4
+#define LZ_LASTLIT  5             // a match never covers the last bytes
+#define LZ_HASHLOG  10
+#define LZ_NONE     0xffff
+
+static uint
+read32(const uchar *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint)p[3] << 24;
+}
+
+static uchar*
+putlen(uchar *op, int len)
+{
+  for(; len >= 255; len -= 255)
+    *op++ = 255;
+  *op++ = len;
+  return op;
+}
+
+// Append a sequence of nlit literals and, if mlen > 0, a match of
+// mlen bytes off bytes back. Returns the new end of output, or 0
+// if it would pass oend.
+static uchar*
+emit(uchar *op, uchar *oend, const uchar *lit, int nlit, int off, int mlen)
+{
+  uchar *token;
+
+  if(op + 1 + nlit + nlit/255 + 1 + 2 + mlen/255 + 1 > oend)
+    return 0;
+  token = op++;
+  *token = (nlit >= 15 ? 15 : nlit) << 4;
+  if(nlit >= 15)
+    op = putlen(op, nlit - 15);
+  memmove(op, lit, nlit);
+  op += nlit;
+  if(mlen == 0)
+    return op;
+  *op++ = off;
+  *op++ = off >> 8;
+  mlen -= LZ_MINMATCH;
+  *token |= mlen >= 15 ? 15 : mlen;
+  if(mlen >= 15)
+    op = putlen(op, mlen - 15);
+  return op;
+}
+
+// Compress n bytes (at most 65535) from src into dst.
+// Returns the compressed length, or -1 if it exceeds cap or
+// there is no memory for the hash table.
+int
+lz_compress(const uchar *src, int n, uchar *dst, int cap)
+{
+  const uchar *ip, *anchor, *ref, *mlimit;
+  uchar *op, *oend;
+  ushort *tab;    // positions of recent 4-byte sequences, by hash
+  uint seq, h;
+  int mlen;
+
+  ip = anchor = src;
+  mlimit = n > LZ_LASTLIT ? src + n - LZ_LASTLIT : src;
+  op = dst;
+  oend = dst + cap;
+
+  // too big for a kernel stack; a page of its own per call
+  // lets compressions run in parallel.
+  if((tab = (ushort*)kalloc()) == 0)
+    return -1;
+  memset(tab, 0xff, sizeof(ushort) << LZ_HASHLOG);
+  while(ip + LZ_MINMATCH <= mlimit){
+    seq = read32(ip);
+    h = (seq * 2654435761U) >> (32 - LZ_HASHLOG);
+    ref = tab[h] == LZ_NONE ? 0 : src + tab[h];
+    tab[h] = ip - src;
+    if(ref == 0 || read32(ref) != seq){
+      ip++;
+      continue;
+    }
+    for(mlen = LZ_MINMATCH; ip + mlen < mlimit && ref[mlen] == ip[mlen]; mlen++)
+      ;
+    if((op = emit(op, oend, anchor, ip - anchor, ip - ref, mlen)) == 0)
+      goto fail;
+    ip += mlen;
+    anchor = ip;
+  }
+  if((op = emit(op, oend, anchor, src + n - anchor, 0, 0)) == 0)
+    goto fail;
+  kfree((char*)tab);
+  return op - dst;
+
+fail:
+  kfree((char*)tab);
+  return -1;
+}
+
+// Decompress n bytes from src into dst, which holds cap bytes.
+// Returns the decompressed length, or -1 if src is malformed.
+int
+lz_decompress(const uchar *src, int n, uchar *dst, int cap)
+{
+  const uchar *ip, *iend, *ref;
+  uchar *op, *oend;
+  int token, len, off, c;
+
+  ip = src;
+  iend = src + n;
+  op = dst;
+  oend = dst + cap;
+  while(ip < iend){
+    token = *ip++;
+    if((len = token >> 4) == 15){
+      do {
+        if(ip >= iend)
+          return -1;
+        len += c = *ip++;
+      } while(c == 255);
+    }
+    if(ip + len > iend || op + len > oend)
+      return -1;
+    memmove(op, ip, len);
+    op += len;
+    ip += len;
+    if(ip >= iend)
+      break;      // last sequence
+
+    if(ip + 2 > iend)
+      return -1;
+    off = ip[0] | ip[1] << 8;
+    ip += 2;
+    if(off == 0 || off > op - dst)
+      return -1;
+    if((len = token & 15) == 15){
+      do {
+        if(ip >= iend)
+          return -1;
+        len += c = *ip++;
+      } while(c == 255);
+    }
+    len += LZ_MINMATCH;
+    if(op + len > oend)
+      return -1;
+    for(ref = op - off; len > 0; len--)
+      *op++ = *ref++;   // may overlap
+  }
+  return op - dst;
+}
@@ -2,12 +2,18 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NIHASH       61  // hash buckets in the i-node cache
+#define NICACHE     100  // unreferenced i-nodes kept cached
+#define NDENTRY     256  // directory entries kept cached
+#define NDHASH      127  // hash buckets in the directory entry cache
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
+#define LOGDEV        2  // device number of external journal disk
+#define NVDISK        2  // virtio disks: root disk, external journal
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
+#define MAXOPBLOCKS  20  // max # of blocks any FS op writes (rename: 18)
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3+1)  // size of disk block cache
+#define NBUF         (LOGSIZE+2*MAXOPBLOCKS)  // size of disk block cache
+#define COMMITTICKS  50  // longest an update waits in an open transaction
 #define FSSIZE       100000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
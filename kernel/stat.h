@@ -2,6 +2,7 @@
 #define T_FILE    2   // File
 #define T_DEVICE  3   // Device
 #define T_VNDIR   4
+#define T_DXDIR   5   // Hash-indexed directory
 
 struct stat {
   int dev;     // File system's disk device
@@ -10,3 +11,21 @@ struct stat {
   short nlink; // Number of links to file
   uint64 size; // Size of file in bytes
 };
+
+// A directory entry as getdents() returns it, for every directory
+// type. Records follow each other in the buffer, reclen apart; the
+// NUL-terminated name comes right after the fixed part. type is 0
+// if the directory does not record it, and type and size are only
+// sure to be filled in with DENT_STAT.
+struct dirent_plus {
+  uint ino;      // Inode number
+  ushort reclen; // Length of this record
+  uchar namelen; // Length of the name
+  uchar type;    // Type of file, or 0
+  uint64 size;   // Size of file in bytes
+};
+
+#define DENT_STAT 0x1   // getdents() flag: read type and size from the inode
+
+#define DENT_RECLEN(namelen) \
+  ((sizeof(struct dirent_plus) + (namelen) + 1 + 7) & ~7)
@@ -107,6 +107,21 @@ extern uint64 sys_uptime(void);
 extern uint64 sys_logswitch(void);
 extern uint64 sys_isvndir(void);
 extern uint64 sys_mkvndir(void);
+extern uint64 sys_logstat(void);
+extern uint64 sys_chattr(void);
+extern uint64 sys_mkdxdir(void);
+extern uint64 sys_atimeswitch(void);
+extern uint64 sys_diskstat(void);
+extern uint64 sys_lseek(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_fallocate(void);
+extern uint64 sys_rename(void);
+extern uint64 sys_rmtree(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_fdatasync(void);
+extern uint64 sys_getdents(void);
+extern uint64 sys_nsearch(void);
 
 
 static uint64 (*syscalls[])(void) = {
@@ -134,6 +149,21 @@ static uint64 (*syscalls[])(void) = {
 [SYS_logswitch] sys_logswitch,
 [SYS_isvndir] sys_isvndir,
 [SYS_mkvndir] sys_mkvndir,
+[SYS_logstat] sys_logstat,
+[SYS_chattr]  sys_chattr,
+[SYS_mkdxdir] sys_mkdxdir,
+[SYS_atimeswitch] sys_atimeswitch,
+[SYS_diskstat] sys_diskstat,
+[SYS_lseek]   sys_lseek,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_fallocate] sys_fallocate,
+[SYS_rename]  sys_rename,
+[SYS_rmtree]  sys_rmtree,
+[SYS_fsync]   sys_fsync,
+[SYS_fdatasync] sys_fdatasync,
+[SYS_getdents] sys_getdents,
+[SYS_nsearch]  sys_nsearch,
 };
 
 void
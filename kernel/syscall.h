@@ -23,3 +23,18 @@
 #define SYS_logswitch 22
 #define SYS_isvndir  23
 #define SYS_mkvndir  24
+#define SYS_logstat  25
+#define SYS_chattr   26
+#define SYS_mkdxdir  27
+#define SYS_atimeswitch 28
+#define SYS_diskstat 29
+#define SYS_lseek    30
+#define SYS_pread    31
+#define SYS_pwrite   32
+#define SYS_fallocate 33
+#define SYS_rename   34
+#define SYS_rmtree   35
+#define SYS_fsync    36
+#define SYS_fdatasync 37
+#define SYS_getdents 38
+#define SYS_nsearch  39
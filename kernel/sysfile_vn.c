@@ -15,6 +15,8 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "logstat.h"
+#include "diskstat.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -91,6 +93,106 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
+
+// Preallocate blocks for len bytes at off of an extent-mapped
+// file, a free run per transaction.
+uint64
+sys_fallocate(void)
+{
+  struct file *f;
+  int mode, off, len, r;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &mode) < 0 || argint(2, &off) < 0 ||
+     argint(3, &len) < 0)
+    return -1;
+  if(f->type != FD_INODE || !f->writable || off < 0 || len <= 0 ||
+     (mode & ~FALLOC_FL_KEEP_SIZE))
+    return -1;
+  while(len > 0){
+    begin_op();
+    ilock(f->ip);
+    r = ifallocate(f->ip, off, len, mode & FALLOC_FL_KEEP_SIZE);
+    iunlock(f->ip);
+    end_op();
+    if(r < 0)
+      return -1;
+    off += r;
+    len -= r;
+  }
+  return 0;
+}
+
+uint64
+sys_lseek(void)
+{
+  struct file *f;
+  int off, whence;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &off) < 0 || argint(2, &whence) < 0)
+    return -1;
+  return fileseek(f, off, whence);
+}
+
+// Wait until the file's updates are on disk. The log commits
+// all pending updates together, so this is the open transaction
+// and not just the file's blocks. fdatasync() leaves lazily kept
+// timestamps in memory; fsync() writes them out first.
+static int
+fsync1(int datasync)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0 || f->type != FD_INODE)
+    return -1;
+  if(!datasync){
+    begin_op();
+    ilock(f->ip);
+    if(f->ip->dirty & I_DIRTY_TIME)
+      iupdate(f->ip);
+    iunlock(f->ip);
+    end_op();
+  }
+  log_sync();
+  return 0;
+}
+
+uint64
+sys_fsync(void)
+{
+  return fsync1(0);
+}
+
+uint64
+sys_fdatasync(void)
+{
+  return fsync1(1);
+}
+
 uint64
 sys_close(void)
 {
@@ -115,12 +217,49 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+uint64
+sys_getdents(void)
+{
+  struct file *f;
+  uint64 buf;
+  int n, flags;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &buf) < 0 || argint(2, &n) < 0 ||
+     argint(3, &flags) < 0)
+    return -1;
+  return filegetdents(f, buf, n, flags);
+}
+
+// Find every entry called name through the filename index, and
+// copy their NUL-terminated absolute paths to buf, n bytes long,
+// as many as fit in a page. Returns the bytes copied.
+uint64
+sys_nsearch(void)
+{
+  char name[NAME_MAX_LEN], *out;
+  uint64 buf;
+  int len, n, r;
+
+  if((len = argstr(0, name, sizeof(name))) <= 0 || argaddr(1, &buf) < 0 ||
+     argint(2, &n) < 0 || n < 0)
+    return -1;
+  if(n > PGSIZE)
+    n = PGSIZE;
+  if((out = kalloc()) == 0)
+    return -1;
+  r = nidx_search(name, len, out, n);
+  if(r > 0 && copyout(myproc()->pagetable, buf, out, r) < 0)
+    r = -1;
+  kfree(out);
+  return r;
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
 {
   //printf("syslink\n");
-  char name[DIRSIZ], new[MAXPATH], old[MAXPATH];
+  char name[DXNAMESIZ], new[MAXPATH], old[MAXPATH];
   struct inode *dp, *ip;
 
   if(argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0)
@@ -134,7 +273,7 @@ sys_link(void)
   }
 
   ilock(ip);
-  if(ip->type == T_DIR){
+  if(ISDIR(ip->type)){
     iunlockput(ip);
     end_op();
     return -1;
@@ -149,7 +288,7 @@ sys_link(void)
   
   
   ilock(dp);
-  if(dp->dev != ip->dev || dirlink_vn(dp, name, name_len, ip->inum) < 0){
+  if(dp->dev != ip->dev || dirlink_vn(dp, name, name_len, ip->inum, ip->type) < 0){
     iunlockput(dp);
     goto bad;
   }
@@ -169,34 +308,15 @@ bad:
   return -1;
 }
 
-// Is the directory dp empty except for "." and ".." ?
+// Remove the directory entry path, in a transaction.
 static int
-isdirempty(struct inode *dp)
-{
-  int off;
-  struct dirent de;
-
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("isdirempty: readi");
-    if(de.inum != 0)
-      return 0;
-  }
-  return 1;
-}
-
-uint64
-sys_unlink(void)
+unlink1(char *path)
 {
-  //printf("sysunlink\n");
   struct inode *ip, *dp;  // dp fu
-  char name[DIRSIZ], path[MAXPATH];
+  char name[DXNAMESIZ];
   uint off, lastoff;
   uint8 name_len;
 
-  if(argstr(0, path, MAXPATH) < 0)
-    return -1;
-
   begin_op();
 
   name_len = get_name_len(path);
@@ -218,14 +338,14 @@ sys_unlink(void)
 
   if(ip->nlink < 1)
     panic("unlink: nlink < 1");
-  if(ip->type == T_DIR && !isdirempty(ip)){
+  if(ISDIR(ip->type) && !dirempty(ip)){
     iunlockput(ip);
     goto bad;
   }
 
   rmdir_vn(dp, off, lastoff);
 
-  if(ip->type == T_DIR || T_VNDIR){
+  if(ISDIR(ip->type)){
     dp->nlink--;
     iupdate(dp);
   }
@@ -245,12 +365,323 @@ bad:
   return -1;
 }
 
+uint64
+sys_unlink(void)
+{
+  char path[MAXPATH];
+
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  return unlink1(path);
+}
+
+// Entries sys_rmtree() removes per transaction. Each dirties the
+// RMDIRBLOCKS of rmdir_vn() and its inode's block; add the
+// directory's own inode and a block of slop.
+#define RMBATCH ((MAXOPBLOCKS-2)/(RMDIRBLOCKS+1))
+
+// Find the first entry of directory dp other than "." and "..",
+// set *off and *lastoff as dirlookup_vn() does, and return its
+// inode. Caller must hold dp->lock.
+static struct inode*
+firstent(struct inode *dp, uint *off, uint *lastoff)
+{
+  char name[NAME_MAX_LEN];
+  uint8 len, type;
+  uint pos, inum;
+
+  for(pos = 0; dirnext(dp, &pos, name, &len, &inum, &type); ){
+    if((len == 1 && name[0] == '.') ||
+       (len == 2 && name[0] == '.' && name[1] == '.'))
+      continue;
+    return dirlookup_vn(dp, name, len, off, lastoff);
+  }
+  return 0;
+}
+
+// Remove path and, if it is a directory, everything below it.
+// Returns the number of entries removed, or -1 if path could not
+// be removed. Works a directory at a time, from the deepest
+// non-empty one up: a transaction unlinks up to RMBATCH of its
+// entries, and the inodes freed are put afterwards, one per
+// transaction, since truncating a large file takes a lot of log.
+uint64
+sys_rmtree(void)
+{
+  char name[DXNAMESIZ], path[MAXPATH];
+  struct inode *top, *cur, *dp, *ip, *down;
+  struct inode *freed[RMBATCH];
+  uint off, lastoff;
+  int n, i, count, stuck;
+
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  begin_op();
+  top = 0;
+  if((dp = nameiparent_vn(path, name)) != 0){
+    if(namecmp(name, ".") != 0 && namecmp(name, "..") != 0)
+      top = namei_vn(path);
+    iput(dp);
+  }
+  end_op();
+  if(top == 0)
+    return -1;
+
+  count = 0;
+  cur = idup(top);
+  for(;;){
+    begin_op();
+    ilock(cur);
+    n = 0;
+    down = 0;
+    stuck = 0;
+    if(ISDIR(cur->type)){
+      while(n < RMBATCH && (ip = firstent(cur, &off, &lastoff)) != 0){
+        ilock(ip);
+        if(ISDIR(ip->type) && !dirempty(ip)){
+          iunlock(ip);
+          down = ip;
+          break;
+        }
+        rmdir_vn(cur, off, lastoff);
+        if(ISDIR(ip->type)){
+          cur->nlink--;
+          iupdate(cur);
+        }
+        ip->nlink--;
+        iupdate(ip);
+        iunlock(ip);
+        freed[n++] = ip;
+      }
+      stuck = n == 0 && down == 0 && !dirempty(cur);
+    }
+    iunlock(cur);
+    end_op();
+
+    for(i = 0; i < n; i++){
+      begin_op();
+      iput(freed[i]);
+      end_op();
+    }
+    count += n;
+
+    if(stuck){
+      // an entry dirnext() sees that dirlookup_vn() cannot find
+      begin_op();
+      iput(cur);
+      iput(top);
+      end_op();
+      return -1;
+    } else if(down){
+      begin_op();
+      iput(cur);
+      end_op();
+      cur = down;
+    } else if(n == 0){
+      // cur is empty: start over from the top to remove it
+      begin_op();
+      iput(cur);
+      end_op();
+      if(cur == top)
+        break;
+      cur = idup(top);
+    }
+  }
+
+  begin_op();
+  iput(top);
+  end_op();
+  if(unlink1(path) < 0)
+    return -1;
+  return count + 1;
+}
+
+// Follow ".." up from directory dp towards the root, and return
+// whichever of a and b comes first, or 0 if neither does.
+// Caller must hold renamelock and no inode locks.
+static struct inode*
+walkup(struct inode *dp, struct inode *a, struct inode *b)
+{
+  struct inode *ip, *next;
+
+  ip = idup(dp);
+  for(;;){
+    if(ip->inum == a->inum || ip->inum == b->inum){
+      next = ip->inum == a->inum ? a : b;
+      iput(ip);
+      return next;
+    }
+    if(ip->inum == ROOTINO)
+      break;
+    ilock(ip);
+    next = dirlookup_vn(ip, "..", 2, 0, 0);
+    iunlockput(ip);
+    if((ip = next) == 0)
+      return 0;
+  }
+  iput(ip);
+  return 0;
+}
+
+// Move the path old to new in one transaction. An existing new is
+// replaced if it is of the same kind and, for a directory, empty.
+// The costliest FS op: replacing new dirties RMDIRBLOCKS, the
+// inodes of new and its directory, and the super block to orphan
+// new; linking LINKBLOCKS, unlinking old RMDIRBLOCKS, and moving
+// a directory its ".." block and old's directory's inode, for
+// 2*RMDIRBLOCKS + LINKBLOCKS + 5 blocks, within MAXOPBLOCKS.
+uint64
+sys_rename(void)
+{
+  char oname[DXNAMESIZ], nname[DXNAMESIZ], old[MAXPATH], new[MAXPATH];
+  struct inode *odp, *ndp, *ip, *tip, *xp;
+  uint ooff, olast, noff, nlast;
+  uint8 olen, nlen;
+
+  if(argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0)
+    return -1;
+  olen = get_name_len(old);
+  nlen = get_name_len(new);
+
+  begin_op();
+  acquiresleep(&renamelock);
+  ip = ndp = 0;
+  if((odp = nameiparent_vn(old, oname)) == 0 ||
+     (ndp = nameiparent_vn(new, nname)) == 0)
+    goto out;
+  if(namecmp(oname, ".") == 0 || namecmp(oname, "..") == 0 ||
+     namecmp(nname, ".") == 0 || namecmp(nname, "..") == 0 ||
+     odp->dev != ndp->dev)
+    goto out;
+
+  // Lock the two directories ancestor first, once sure that
+  // old is not an ancestor of new. Nor may new be an ancestor
+  // of old's directory: it would be locked after it below, and
+  // could not be replaced anyway, not being empty.
+  if(odp == ndp){
+    ilock(odp);
+  } else {
+    ilock(odp);
+    ip = dirlookup_vn(odp, oname, olen, 0, 0);
+    iunlock(odp);
+    if(ip == 0 || (xp = walkup(ndp, ip, odp)) == ip)
+      goto out;
+    ilock(ndp);
+    tip = dirlookup_vn(ndp, nname, nlen, 0, 0);
+    iunlock(ndp);
+    if(tip){
+      if(walkup(odp, tip, tip) == tip){
+        iput(tip);
+        goto out;
+      }
+      iput(tip);
+    }
+    if(xp == odp){
+      ilock(odp);
+      ilock(ndp);
+    } else {
+      ilock(ndp);
+      ilock(odp);
+    }
+  }
+
+  if((xp = dirlookup_vn(odp, oname, olen, &ooff, &olast)) == 0 ||
+     (ip && xp->inum != ip->inum) || ndp->nlink < 1){
+    if(xp)
+      iput(xp);
+    goto unlock;
+  }
+  if(ip)
+    iput(ip);
+  ip = xp;
+  ilock(ip);
+
+  if((tip = dirlookup_vn(ndp, nname, nlen, &noff, &nlast)) != 0){
+    if(tip->inum == ip->inum){
+      iput(tip);
+      goto done;    // old and new are the same file already
+    }
+    if(tip == odp){
+      iput(tip);
+      goto unlockip;
+    }
+    ilock(tip);
+    if(ISDIR(tip->type) != ISDIR(ip->type) ||
+       (ISDIR(tip->type) && !dirempty(tip))){
+      iunlockput(tip);
+      goto unlockip;
+    }
+    rmdir_vn(ndp, noff, nlast);
+    if(ISDIR(tip->type)){
+      ndp->nlink--;
+      iupdate(ndp);
+    }
+    tip->nlink--;
+    iupdate(tip);
+    iunlockput(tip);
+  }
+
+  if(dirlink_vn(ndp, nname, nlen, ip->inum, ip->type) < 0)
+    goto unlockip;
+  // linking into the same directory may have moved old's entry
+  if(odp == ndp){
+    if((xp = dirlookup_vn(odp, oname, olen, &ooff, &olast)) == 0)
+      panic("rename: lost old");
+    iput(xp);
+  }
+  rmdir_vn(odp, ooff, olast);
+
+  if(ISDIR(ip->type) && odp != ndp){
+    if((xp = dirlookup_vn(ip, "..", 2, &noff, &nlast)) == 0)
+      panic("rename: no ..");
+    iput(xp);
+    rmdir_vn(ip, noff, nlast);
+    if(dirlink_vn(ip, "..", 2, ndp->inum, ndp->type) < 0)
+      panic("rename: ..");
+    odp->nlink--;
+    iupdate(odp);
+    ndp->nlink++;
+    iupdate(ndp);
+  }
+
+done:
+  iunlockput(ip);
+  if(odp != ndp)
+    iunlock(odp);
+  iunlockput(ndp);
+  iput(odp);
+  releasesleep(&renamelock);
+  end_op();
+  return 0;
+
+unlockip:
+  iunlock(ip);
+unlock:
+  if(odp != ndp)
+    iunlock(odp);
+  iunlock(ndp);
+out:
+  if(ip)
+    iput(ip);
+  if(ndp)
+    iput(ndp);
+  if(odp)
+    iput(odp);
+  releasesleep(&renamelock);
+  end_op();
+  return -1;
+}
+
+// Create path as a new inode of type, locked, or return the
+// existing file for T_FILE. Dirties the new inode's block and
+// inode map block, dp's inode, a new directory's first two blocks
+// and their bitmap block, and LINKBLOCKS: LINKBLOCKS + 6 in all.
 static struct inode*
 create(char *path, short type, short major, short minor)
 {
   //printf("create\n");
   struct inode *ip, *dp;
-  char name[DIRSIZ];
+  char name[DXNAMESIZ];
   uint8 name_len;
 
   name_len = get_name_len(path);
@@ -284,15 +715,26 @@ create(char *path, short type, short major, short minor)
     if(dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", dp->inum) < 0)
       panic("create dots");
   }
-  if(type == T_VNDIR){  // Create . and .. entries.
+  if(type == T_VNDIR || type == T_DXDIR){  // Create . and .. entries.
     dp->nlink++;  // for ".."
     iupdate(dp);
     // No ip->nlink++ for ".": avoid cyclic ref count.
-    if(dirlink_vn(ip, ".", 1, ip->inum) < 0 || dirlink_vn(ip, "..", 2, dp->inum) < 0)
+    if(dirlink_vn(ip, ".", 1, ip->inum, ip->type) < 0 ||
+       dirlink_vn(ip, "..", 2, dp->inum, dp->type) < 0)
       panic("create dots");
   }
-  if(dirlink_vn(dp, name, name_len, ip->inum) < 0)
-    panic("create: dirlink");
+  if(dirlink_vn(dp, name, name_len, ip->inum, ip->type) < 0){
+    // dp is full (or the name too long for it): undo.
+    if(ISDIR(type)){
+      dp->nlink--;
+      iupdate(dp);
+    }
+    ip->nlink = 0;
+    iupdate(ip);
+    iunlockput(ip);
+    iunlockput(dp);
+    return 0;
+  }
   iunlockput(dp);
   return ip;
 }
@@ -326,7 +768,7 @@ sys_open(void)
       return -1;
     }
     ilock(ip);
-    if(ip->type == T_DIR && omode != O_RDONLY){
+    if(ISDIR(ip->type) && omode != O_RDONLY){
       iunlockput(ip);
       end_op();
       return -1;
@@ -357,6 +799,7 @@ sys_open(void)
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  f->sync = (omode & O_SYNC) != 0;
 
   if((omode & O_TRUNC) && ip->type == T_FILE){
     itrunc(ip);
@@ -400,6 +843,22 @@ sys_mkvndir(void)
   return 0;
 }
 
+uint64
+sys_mkdxdir(void)
+{
+  char path[MAXPATH];
+  struct inode *ip;
+
+  begin_op();
+  if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DXDIR, 0, 0)) == 0){
+    end_op();
+    return -1;
+  }
+  iunlockput(ip);
+  end_op();
+  return 0;
+}
+
 uint64
 sys_mknod(void)
 {
@@ -435,7 +894,7 @@ sys_chdir(void)
     return -1;
   }
   ilock(ip);
-  if(ip->type != T_DIR && ip->type != T_VNDIR){
+  if(!ISDIR(ip->type)){
     iunlockput(ip);
     end_op();
     return -1;
@@ -554,4 +1013,68 @@ sys_logswitch(void)
     return -1;
   switchs(x);
     return 0;
-}
\ No newline at end of file
+}
+
+// Set the mount-wide atime mode (-1 to query); returns the old one.
+uint64
+sys_atimeswitch(void)
+{
+  int mode;
+
+  if(argint(0, &mode) < 0)
+    return -1;
+  return atimeswitch(mode);
+}
+
+// Copy journal statistics to user space; reset them if asked.
+uint64
+sys_logstat(void)
+{
+  uint64 addr;
+  int reset;
+  struct logstat st;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &reset) < 0)
+    return -1;
+  logstat_get(&st, reset);
+  if(copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+// Copy disk transfer counts to user space; reset them if asked.
+uint64
+sys_diskstat(void)
+{
+  uint64 addr;
+  int reset;
+  struct diskstat st;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &reset) < 0)
+    return -1;
+  virtio_disk_stat(&st, reset);
+  if(copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+// Set, then clear, inode flags (fs.h *_FL) of an open file.
+// Returns the resulting flags.
+uint64
+sys_chattr(void)
+{
+  struct file *f;
+  int set, clear, r;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &set) < 0 || argint(2, &clear) < 0)
+    return -1;
+  if(f->type != FD_INODE)
+    return -1;
+
+  begin_op();
+  ilock(f->ip);
+  r = isetflags(f->ip, set, clear);
+  iunlock(f->ip);
+  end_op();
+  return r;
+}
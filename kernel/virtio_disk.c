@@ -5,6 +5,9 @@
 //
 // qemu ... -drive file=fs.img,if=none,format=raw,id=x0 -device virtio-blk-device,drive=x0,bus=virtio-mmio-bus.0
 //
+// an optional second disk on virtio-mmio-bus.1 holds an external
+// journal; buffers with b->dev == LOGDEV are sent to it.
+//
 
 #include "types.h"
 #include "riscv.h"
@@ -16,9 +19,10 @@
 #include "fs.h"
 #include "buf.h"
 #include "virtio.h"
+#include "diskstat.h"
 
-// the address of virtio mmio register r.
-#define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
+// the address of virtio mmio register r of disk id.
+#define R(id, r) ((volatile uint32 *)(VIRTIO0 + (uint64)(id)*VIRTIO_STRIDE + (r)))
 
 static struct disk {
   // the virtio driver and device mostly communicate through a set of
@@ -70,31 +74,71 @@ static struct disk {
   struct virtio_blk_req ops[NUM];
   
   struct spinlock vdisk_lock;
+
+  int present;  // was a disk found at this mmio slot?
+  uint64 nread;   // blocks transferred, for diskstat()
+  uint64 nwrite;
   
-} __attribute__ ((aligned (PGSIZE))) disk;
+} __attribute__ ((aligned (PGSIZE))) disks[NVDISK];
+
+static void virtio_disk_init1(int);
 
 void
 virtio_disk_init(void)
 {
+  virtio_disk_init1(0);
+  if(!disks[0].present)
+    panic("could not find virtio disk");
+  virtio_disk_init1(1);
+}
+
+// Is there a disk behind device number dev?
+int
+virtio_disk_present(uint dev)
+{
+  return disks[dev == LOGDEV ? 1 : 0].present;
+}
+
+// Copy the transfer counts of each disk to st; reset them if asked.
+void
+virtio_disk_stat(struct diskstat *st, int reset)
+{
+  int id;
+
+  memset(st, 0, sizeof(*st));
+  for(id = 0; id < NVDISK && id < NDISKSTAT; id++){
+    acquire(&disks[id].vdisk_lock);
+    st->nread[id] = disks[id].nread;
+    st->nwrite[id] = disks[id].nwrite;
+    if(reset)
+      disks[id].nread = disks[id].nwrite = 0;
+    release(&disks[id].vdisk_lock);
+  }
+}
+
+static void
+virtio_disk_init1(int id)
+{
+  struct disk *disk = &disks[id];
   uint32 status = 0;
 
-  initlock(&disk.vdisk_lock, "virtio_disk");
+  initlock(&disk->vdisk_lock, "virtio_disk");
 
-  if(*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
-     *R(VIRTIO_MMIO_VERSION) != 1 ||
-     *R(VIRTIO_MMIO_DEVICE_ID) != 2 ||
-     *R(VIRTIO_MMIO_VENDOR_ID) != 0x554d4551){
-    panic("could not find virtio disk");
+  if(*R(id, VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
+     *R(id, VIRTIO_MMIO_VERSION) != 1 ||
+     *R(id, VIRTIO_MMIO_DEVICE_ID) != 2 ||
+     *R(id, VIRTIO_MMIO_VENDOR_ID) != 0x554d4551){
+    return;
   }
   
   status |= VIRTIO_CONFIG_S_ACKNOWLEDGE;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(id, VIRTIO_MMIO_STATUS) = status;
 
   status |= VIRTIO_CONFIG_S_DRIVER;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(id, VIRTIO_MMIO_STATUS) = status;
 
   // negotiate features
-  uint64 features = *R(VIRTIO_MMIO_DEVICE_FEATURES);
+  uint64 features = *R(id, VIRTIO_MMIO_DEVICE_FEATURES);
   features &= ~(1 << VIRTIO_BLK_F_RO);
   features &= ~(1 << VIRTIO_BLK_F_SCSI);
   features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
@@ -102,51 +146,54 @@ virtio_disk_init(void)
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
   features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
   features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
-  *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  *R(id, VIRTIO_MMIO_DRIVER_FEATURES) = features;
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(id, VIRTIO_MMIO_STATUS) = status;
 
   // tell device we're completely ready.
   status |= VIRTIO_CONFIG_S_DRIVER_OK;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(id, VIRTIO_MMIO_STATUS) = status;
 
-  *R(VIRTIO_MMIO_GUEST_PAGE_SIZE) = PGSIZE;
+  *R(id, VIRTIO_MMIO_GUEST_PAGE_SIZE) = PGSIZE;
 
   // initialize queue 0.
-  *R(VIRTIO_MMIO_QUEUE_SEL) = 0;
-  uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
+  *R(id, VIRTIO_MMIO_QUEUE_SEL) = 0;
+  uint32 max = *R(id, VIRTIO_MMIO_QUEUE_NUM_MAX);
   if(max == 0)
     panic("virtio disk has no queue 0");
   if(max < NUM)
     panic("virtio disk max queue too short");
-  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
-  memset(disk.pages, 0, sizeof(disk.pages));
-  *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk.pages) >> PGSHIFT;
+  *R(id, VIRTIO_MMIO_QUEUE_NUM) = NUM;
+  memset(disk->pages, 0, sizeof(disk->pages));
+  *R(id, VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk->pages) >> PGSHIFT;
 
   // desc = pages -- num * virtq_desc
   // avail = pages + 0x40 -- 2 * uint16, then num * uint16
   // used = pages + 4096 -- 2 * uint16, then num * vRingUsedElem
 
-  disk.desc = (struct virtq_desc *) disk.pages;
-  disk.avail = (struct virtq_avail *)(disk.pages + NUM*sizeof(struct virtq_desc));
-  disk.used = (struct virtq_used *) (disk.pages + PGSIZE);
+  disk->desc = (struct virtq_desc *) disk->pages;
+  disk->avail = (struct virtq_avail *)(disk->pages + NUM*sizeof(struct virtq_desc));
+  disk->used = (struct virtq_used *) (disk->pages + PGSIZE);
 
   // all NUM descriptors start out unused.
   for(int i = 0; i < NUM; i++)
-    disk.free[i] = 1;
+    disk->free[i] = 1;
 
-  // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
+  disk->present = 1;
+
+  // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ
+  // and VIRTIO1_IRQ.
 }
 
 // find a free descriptor, mark it non-free, return its index.
 static int
-alloc_desc()
+alloc_desc(struct disk *disk)
 {
   for(int i = 0; i < NUM; i++){
-    if(disk.free[i]){
-      disk.free[i] = 0;
+    if(disk->free[i]){
+      disk->free[i] = 0;
       return i;
     }
   }
@@ -155,28 +202,28 @@ alloc_desc()
 
 // mark a descriptor as free.
 static void
-free_desc(int i)
+free_desc(struct disk *disk, int i)
 {
   if(i >= NUM)
     panic("free_desc 1");
-  if(disk.free[i])
+  if(disk->free[i])
     panic("free_desc 2");
-  disk.desc[i].addr = 0;
-  disk.desc[i].len = 0;
-  disk.desc[i].flags = 0;
-  disk.desc[i].next = 0;
-  disk.free[i] = 1;
-  wakeup(&disk.free[0]);
+  disk->desc[i].addr = 0;
+  disk->desc[i].len = 0;
+  disk->desc[i].flags = 0;
+  disk->desc[i].next = 0;
+  disk->free[i] = 1;
+  wakeup(&disk->free[0]);
 }
 
 // free a chain of descriptors.
 static void
-free_chain(int i)
+free_chain(struct disk *disk, int i)
 {
   while(1){
-    int flag = disk.desc[i].flags;
-    int nxt = disk.desc[i].next;
-    free_desc(i);
+    int flag = disk->desc[i].flags;
+    int nxt = disk->desc[i].next;
+    free_desc(disk, i);
     if(flag & VRING_DESC_F_NEXT)
       i = nxt;
     else
@@ -187,13 +234,13 @@ free_chain(int i)
 // allocate three descriptors (they need not be contiguous).
 // disk transfers always use three descriptors.
 static int
-alloc3_desc(int *idx)
+alloc3_desc(struct disk *disk, int *idx)
 {
   for(int i = 0; i < 3; i++){
-    idx[i] = alloc_desc();
+    idx[i] = alloc_desc(disk);
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
-        free_desc(idx[j]);
+        free_desc(disk, idx[j]);
       return -1;
     }
   }
@@ -204,8 +251,17 @@ void
 virtio_disk_rw(struct buf *b, int write)
 {
   uint64 sector = b->blockno * (BSIZE / 512);
+  int id = b->dev == LOGDEV ? 1 : 0;
+  struct disk *disk = &disks[id];
 
-  acquire(&disk.vdisk_lock);
+  if(!disk->present)
+    panic("virtio_disk_rw: no disk");
+
+  acquire(&disk->vdisk_lock);
+  if(write)
+    disk->nwrite++;
+  else
+    disk->nread++;
 
   // the spec's Section 5.2 says that legacy block operations use
   // three descriptors: one for type/reserved/sector, one for the
@@ -214,16 +270,16 @@ virtio_disk_rw(struct buf *b, int write)
   // allocate the three descriptors.
   int idx[3];
   while(1){
-    if(alloc3_desc(idx) == 0) {
+    if(alloc3_desc(disk, idx) == 0) {
       break;
     }
-    sleep(&disk.free[0], &disk.vdisk_lock);
+    sleep(&disk->free[0], &disk->vdisk_lock);
   }
 
   // format the three descriptors.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
+  struct virtio_blk_req *buf0 = &disk->ops[idx[0]];
 
   if(write)
     buf0->type = VIRTIO_BLK_T_OUT; // write the disk
@@ -232,57 +288,59 @@ virtio_disk_rw(struct buf *b, int write)
   buf0->reserved = 0;
   buf0->sector = sector;
 
-  disk.desc[idx[0]].addr = (uint64) buf0;
-  disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
+  disk->desc[idx[0]].addr = (uint64) buf0;
+  disk->desc[idx[0]].len = sizeof(struct virtio_blk_req);
+  disk->desc[idx[0]].flags = VRING_DESC_F_NEXT;
+  disk->desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
+  disk->desc[idx[1]].addr = (uint64) b->data;
+  disk->desc[idx[1]].len = BSIZE;
   if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
+    disk->desc[idx[1]].flags = 0; // device reads b->data
   else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+    disk->desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
+  disk->desc[idx[1]].flags |= VRING_DESC_F_NEXT;
+  disk->desc[idx[1]].next = idx[2];
 
-  disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  disk->info[idx[0]].status = 0xff; // device writes 0 on success
+  disk->desc[idx[2]].addr = (uint64) &disk->info[idx[0]].status;
+  disk->desc[idx[2]].len = 1;
+  disk->desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk->desc[idx[2]].next = 0;
 
   // record struct buf for virtio_disk_intr().
   b->disk = 1;
-  disk.info[idx[0]].b = b;
+  disk->info[idx[0]].b = b;
 
   // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  disk->avail->ring[disk->avail->idx % NUM] = idx[0];
 
   __sync_synchronize();
 
   // tell the device another avail ring entry is available.
-  disk.avail->idx += 1; // not % NUM ...
+  disk->avail->idx += 1; // not % NUM ...
 
   __sync_synchronize();
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  *R(id, VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
 
   // Wait for virtio_disk_intr() to say request has finished.
   while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+    sleep(b, &disk->vdisk_lock);
   }
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  disk->info[idx[0]].b = 0;
+  free_chain(disk, idx[0]);
 
-  release(&disk.vdisk_lock);
+  release(&disk->vdisk_lock);
 }
 
 void
-virtio_disk_intr()
+virtio_disk_intr(int id)
 {
-  acquire(&disk.vdisk_lock);
+  struct disk *disk = &disks[id];
+
+  acquire(&disk->vdisk_lock);
 
   // the device won't raise another interrupt until we tell it
   // we've seen this interrupt, which the following line does.
@@ -290,26 +348,26 @@ virtio_disk_intr()
   // the "used" ring, in which case we may process the new
   // completion entries in this interrupt, and have nothing to do
   // in the next interrupt, which is harmless.
-  *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
+  *R(id, VIRTIO_MMIO_INTERRUPT_ACK) = *R(id, VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
 
   __sync_synchronize();
 
-  // the device increments disk.used->idx when it
+  // the device increments disk->used->idx when it
   // adds an entry to the used ring.
 
-  while(disk.used_idx != disk.used->idx){
+  while(disk->used_idx != disk->used->idx){
     __sync_synchronize();
-    int id = disk.used->ring[disk.used_idx % NUM].id;
+    int d = disk->used->ring[disk->used_idx % NUM].id;
 
-    if(disk.info[id].status != 0)
+    if(disk->info[d].status != 0)
       panic("virtio_disk_intr status");
 
-    struct buf *b = disk.info[id].b;
+    struct buf *b = disk->info[d].b;
     b->disk = 0;   // disk is done with buf
     wakeup(b);
 
-    disk.used_idx += 1;
+    disk->used_idx += 1;
   }
 
-  release(&disk.vdisk_lock);
+  release(&disk->vdisk_lock);
 }
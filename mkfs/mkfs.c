@@ -18,12 +18,19 @@
 #define NINODES 200
 
 // Disk layout:
-// [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
+// [ boot block | sb block | log | inode blocks | inode map | free bit map | name index | data blocks ]
+//
+// With -j logimg the log goes into its own image instead, for use as
+// an external journal on a second disk:
+// [ boot block | sb block | inode blocks | inode map | free bit map | name index | data blocks ]
+// [ log ]
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
+int nimap = NINODES/(BSIZE*8) + 1;
 int nlog = LOGSIZE;
-int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
+int nnidx = FSSIZE/(8*NIDXENT) + 1;  // room for a name per 8 blocks
+int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, imap, bitmap, name index)
 int nblocks;  // Number of data blocks
 
 int fsfd;
@@ -34,6 +41,7 @@ uint freeblock;
 
 
 void balloc(int);
+void imap(int);
 void wsect(uint, void*);
 void winode(uint, struct dinode*);
 void rinode(uint inum, struct dinode *ip);
@@ -41,6 +49,8 @@ void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
 void die(const char *);
+void writelog(char *);
+void nidxadd(uint dir, char *name, uint inum);
 
 // convert to intel byte order
 ushort
@@ -68,7 +78,8 @@ xint(uint x)
 int
 main(int argc, char *argv[])
 {
-  int i, cc, fd;
+  int i, cc, fd, first;
+  char *logimg;
   uint rootino, inum, off;
   struct dirent de;
   char buf[BSIZE];
@@ -77,20 +88,30 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  logimg = 0;
+  first = 1;
+  if(argc > 2 && strcmp(argv[1], "-j") == 0){
+    logimg = argv[2];
+    first = 3;
+  }
+
+  if(argc < first + 1){
+    fprintf(stderr, "Usage: mkfs [-j log.img] fs.img files...\n");
     exit(1);
   }
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
 
-  fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
+  if(logimg)
+    writelog(logimg);
+
+  fsfd = open(argv[first], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0)
-    die(argv[1]);
+    die(argv[first]);
 
   // 1 fs block = 1 disk sector
-  nmeta = 2 + nlog + ninodeblocks + nbitmap;
+  nmeta = 2 + (logimg ? 0 : nlog) + ninodeblocks + nimap + nbitmap + nnidx;
   nblocks = FSSIZE - nmeta;
 
   sb.magic = FSMAGIC;
@@ -98,12 +119,25 @@ main(int argc, char *argv[])
   sb.nblocks = xint(nblocks);
   sb.ninodes = xint(NINODES);
   sb.nlog = xint(nlog);
-  sb.logstart = xint(2);
-  sb.inodestart = xint(2+nlog);
-  sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.nnidx = xint(nnidx);
+  if(logimg){
+    sb.logdev = xint(LOGDEV);
+    sb.logstart = xint(0);
+    sb.inodestart = xint(2);
+    sb.imapstart = xint(2+ninodeblocks);
+    sb.bmapstart = xint(2+ninodeblocks+nimap);
+    sb.nidxstart = xint(2+ninodeblocks+nimap+nbitmap);
+  } else {
+    sb.logdev = xint(0);
+    sb.logstart = xint(2);
+    sb.inodestart = xint(2+nlog);
+    sb.imapstart = xint(2+nlog+ninodeblocks);
+    sb.bmapstart = xint(2+nlog+ninodeblocks+nimap);
+    sb.nidxstart = xint(2+nlog+ninodeblocks+nimap+nbitmap);
+  }
 
-  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, inode map blocks %u, bitmap blocks %u, name index blocks %u) blocks %d total %d\n",
+         nmeta, logimg ? 0 : nlog, ninodeblocks, nimap, nbitmap, nnidx, nblocks, FSSIZE);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
@@ -127,7 +161,7 @@ main(int argc, char *argv[])
   strcpy(de.name, "..");
   iappend(rootino, &de, sizeof(de));
 
-  for(i = 2; i < argc; i++){
+  for(i = first + 1; i < argc; i++){
     // get rid of "user/"
     char *shortname;
     if(strncmp(argv[i], "user/", 5) == 0)
@@ -153,6 +187,7 @@ main(int argc, char *argv[])
     de.inum = xshort(inum);
     strncpy(de.name, shortname, DIRSIZ);
     iappend(rootino, &de, sizeof(de));
+    nidxadd(rootino, de.name, inum);
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -168,6 +203,7 @@ main(int argc, char *argv[])
   winode(rootino, &din);
 
   balloc(freeblock);
+  imap(freeinode);
 
   exit(0);
 }
@@ -247,6 +283,23 @@ balloc(int used)
   wsect(sb.bmapstart, buf);
 }
 
+// Mark inodes 0 .. used-1 allocated in the inode map.
+// Inode 0 is never handed out.
+void
+imap(int used)
+{
+  uchar buf[BSIZE];
+  int i;
+
+  assert(used < BSIZE*8);
+  bzero(buf, BSIZE);
+  for(i = 0; i < used; i++){
+    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+  }
+  printf("imap: first %d inodes have been allocated\n", used);
+  wsect(sb.imapstart, buf);
+}
+
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
 void
@@ -293,6 +346,82 @@ iappend(uint inum, void *xp, int n)
   winode(inum, &din);
 }
 
+// The kernel's murmur3_32(), for the filename index.
+uint
+murmur3(const uchar *key, int len, uint seed)
+{
+  uint h = seed, k;
+  int i;
+
+  for(i = len >> 2; i; i--){
+    memmove(&k, key, sizeof(k));
+    key += sizeof(k);
+    k *= 0xcc9e2d51;
+    k = (k << 15) | (k >> 17);
+    k *= 0x1b873593;
+    h ^= k;
+    h = (h << 13) | (h >> 19);
+    h = h * 5 + 0xe6546b64;
+  }
+  k = 0;
+  for(i = len & 3; i; i--){
+    k <<= 8;
+    k |= key[i - 1];
+  }
+  k *= 0xcc9e2d51;
+  k = (k << 15) | (k >> 17);
+  k *= 0x1b873593;
+  h ^= k;
+  h ^= len;
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h;
+}
+
+// Add name, at most DIRSIZ bytes, in directory dir to the
+// filename index, in its home block.
+void
+nidxadd(uint dir, char *name, uint inum)
+{
+  char buf[BSIZE];
+  struct nidx_head *h;
+  struct nidx_ent *e;
+  uint hash, bn;
+
+  hash = murmur3((uchar*)name, strnlen(name, DIRSIZ), NIDX_SEED);
+  bn = xint(sb.nidxstart) + hash % nnidx;
+  rsect(bn, buf);
+  h = (struct nidx_head*)buf;
+  assert(xint(h->count) < NIDXENT);
+  e = (struct nidx_ent*)(h + 1) + xint(h->count);
+  e->hash = xint(hash);
+  e->dir = xint(dir);
+  e->inum = xint(inum);
+  h->count = xint(xint(h->count) + 1);
+  wsect(bn, buf);
+}
+
+// Create an empty external journal image: a zeroed log header
+// followed by nlog-1 log blocks.
+void
+writelog(char *path)
+{
+  int i, fd;
+
+  fd = open(path, O_RDWR|O_CREAT|O_TRUNC, 0666);
+  if(fd < 0)
+    die(path);
+  for(i = 0; i < nlog; i++){
+    if(write(fd, zeroes, BSIZE) != BSIZE)
+      die("write");
+  }
+  close(fd);
+  printf("log: %d blocks in %s\n", nlog, path);
+}
+
 void
 die(const char *s)
 {
@@ -0,0 +1,30 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+// atimeswitch [strict|relatime|noatime]
+// Set when reads update access times; with no argument, print it.
+
+char *modes[] = { "strict", "relatime", "noatime" };
+
+int
+main(int argc, char *argv[])
+{
+  int i;
+
+  if(argc < 2){
+    i = atimeswitch(-1);
+    printf("%s\n", i >= 0 && i < 3 ? modes[i] : "?");
+    exit(0);
+  }
+  for(i = 0; i < 3; i++){
+    if(strcmp(argv[1], modes[i]) == 0){
+      atimeswitch(i);
+      printf("%s\n", modes[i]);
+      exit(0);
+    }
+  }
+  fprintf(2, "Usage: atimeswitch [strict|relatime|noatime]\n");
+  exit(1);
+}
@@ -0,0 +1,76 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+// chattr [+-]flags file...
+// Set (+) or clear (-) inode flags; with no flags, print them.
+
+struct {
+  char c;
+  int flag;
+} flagtab[] = {
+  { 's', SECRM_FL },
+  { 'u', UNRM_FL },
+  { 'c', COMPR_FL },
+  { 'S', SYNC_FL },
+  { 'i', IMMUTABLE_FL },
+  { 'a', APPEND_FL },
+  { 'd', NODUMP_FL },
+  { 'A', NOATIME_FL },
+  { 'e', EXTENT_FL },
+  { 'N', INLINE_FL },
+};
+
+int
+parse(char *s, int *flags)
+{
+  int i;
+
+  *flags = 0;
+  for(s++; *s; s++){
+    for(i = 0; i < sizeof(flagtab)/sizeof(flagtab[0]); i++)
+      if(flagtab[i].c == *s)
+        break;
+    if(i == sizeof(flagtab)/sizeof(flagtab[0]))
+      return -1;
+    *flags |= flagtab[i].flag;
+  }
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, fd, r, set, clear, first;
+
+  set = clear = 0;
+  first = 1;
+  if(argc > 2 && (argv[1][0] == '+' || argv[1][0] == '-')){
+    if(parse(argv[1], argv[1][0] == '+' ? &set : &clear) < 0){
+      fprintf(2, "chattr: unknown flag in %s\n", argv[1]);
+      exit(1);
+    }
+    first = 2;
+  }
+  if(argc <= first){
+    fprintf(2, "Usage: chattr [+-]flags files...\n");
+    exit(1);
+  }
+
+  for(i = first; i < argc; i++){
+    if((fd = open(argv[i], 0)) < 0){
+      fprintf(2, "chattr: cannot open %s\n", argv[i]);
+      continue;
+    }
+    if((r = chattr(fd, set, clear)) < 0){
+      fprintf(2, "chattr: %s failed\n", argv[i]);
+    } else {
+      for(j = 0; j < sizeof(flagtab)/sizeof(flagtab[0]); j++)
+        printf("%c", (r & flagtab[j].flag) ? flagtab[j].c : '-');
+      printf(" %s\n", argv[i]);
+    }
+    close(fd);
+  }
+  exit(0);
+}
@@ -0,0 +1,70 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+#include "kernel/diskstat.h"
+#include "user/user.h"
+
+// comprbench [kbytes]
+// Write and read back a file of 'a's, first plain and then with
+// COMPR_FL, and print the disk blocks each phase transferred.
+
+char buf[1024];
+
+void
+run(char *path, int flags, int kb)
+{
+  struct diskstat st;
+  int fd, i;
+  uint64 w, r;
+
+  unlink(path);
+  if((fd = open(path, O_CREATE | O_RDWR)) < 0){
+    fprintf(2, "comprbench: cannot create %s\n", path);
+    exit(1);
+  }
+  if(flags && chattr(fd, flags, 0) < 0){
+    fprintf(2, "comprbench: chattr failed\n");
+    exit(1);
+  }
+  diskstat(&st, 1);
+  memset(buf, 'a', sizeof(buf));
+  for(i = 0; i < kb; i++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      fprintf(2, "comprbench: write failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+  diskstat(&st, 1);
+  w = st.nwrite[0] + st.nwrite[1];
+
+  if((fd = open(path, O_RDONLY)) < 0){
+    fprintf(2, "comprbench: cannot open %s\n", path);
+    exit(1);
+  }
+  for(i = 0; i < kb; i++){
+    if(read(fd, buf, sizeof(buf)) != sizeof(buf) || buf[0] != 'a' || buf[sizeof(buf)-1] != 'a'){
+      fprintf(2, "comprbench: read back failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+  diskstat(&st, 1);
+  r = st.nread[0] + st.nread[1];
+
+  printf("%s: %d KB logical, %l blocks written, %l blocks read\n",
+         flags ? "compressed" : "plain", kb, w, r);
+  unlink(path);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int kb;
+
+  kb = argc > 1 ? atoi(argv[1]) : 1024;
+  run("comprbench.plain", 0, kb);
+  run("comprbench.compr", COMPR_FL, kb);
+  exit(0);
+}
@@ -40,7 +40,7 @@ main(int argc, char* argv[])
 
   int m = strlen(filename);
   int n = strlen(rb);
-  char dest[m + n];
+  char dest[m + n + 1];
 
   for (int j = 0; j != n;j++)
   {
@@ -54,6 +54,7 @@ main(int argc, char* argv[])
   {
     dest[n + i] = filenamenp[i];
   }
+  dest[n + p] = 0;
   // fprintf(2,"filename : ");
   // fprintf(2, filename);
   // fprintf(2, "\n");
@@ -62,9 +63,8 @@ main(int argc, char* argv[])
 
   fprintf(2,"filemane : %s\n",filename);
   fprintf(2, "dest : %s\n", dest);
-  if (link(filename, dest) < 0)
+  if (rename(filename, dest) < 0)
     fprintf(2, "can't del %s: failed\n", argv[1]);
-  unlink(argv[1]);
   
   exit(0);
 }
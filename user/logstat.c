@@ -0,0 +1,59 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/logstat.h"
+#include "user/user.h"
+
+// logstat [reset]
+// Print journal statistics; with "reset", clear them afterwards.
+
+char *modes[] = { "none", "complete", "meta" };
+
+void
+hist(char *title, char *unit, uint64 *h)
+{
+  int i;
+  uint64 lo;
+
+  printf("%s:\n", title);
+  for(i = 0; i < NLOGHIST; i++){
+    if(h[i] == 0)
+      continue;
+    lo = i == 0 ? 0 : 1L << (i - 1);
+    if(i == NLOGHIST - 1)
+      printf("  >= %l %s: %l\n", lo, unit, h[i]);
+    else
+      printf("  %l..%l %s: %l\n", lo, i == 0 ? 0 : (1L << i) - 1, unit, h[i]);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct logstat st;
+  int i, reset;
+
+  reset = argc > 1 && strcmp(argv[1], "reset") == 0;
+  if(logstat(&st, reset) < 0){
+    fprintf(2, "logstat: failed\n");
+    exit(1);
+  }
+
+  printf("mode %s, log size %d blocks\n",
+         st.mode >= 0 && st.mode < 3 ? modes[st.mode] : "?", st.size);
+  printf("begin_op %l, waited %l\n", st.nbegin, st.nwait);
+  printf("commits %l, log_write %l, absorbed %l\n",
+         st.ncommit, st.nlogwrite, st.nabsorb);
+  hist("commit latency", "us", st.commit_us);
+  hist("transaction size", "blocks", st.txblocks);
+  hist("begin_op wait", "us", st.wait_us);
+  printf("absorption ratio:\n");
+  for(i = 0; i < NABSORBHIST; i++){
+    if(st.absorb[i] == 0)
+      continue;
+    if(i == NABSORBHIST - 1)
+      printf("  100%%: %l\n", st.absorb[i]);
+    else
+      printf("  %d..%d%%: %l\n", i * 10, i * 10 + 9, st.absorb[i]);
+  }
+  exit(0);
+}
@@ -22,12 +22,13 @@ fmtname(char *path)
   return buf;
 }
 
+char dents[1024];
+
 void
 ls(char *path)
 {
-  char buf[512], *p;
-  int fd;
-  struct dirent de;
+  int fd, n, i;
+  struct dirent_plus *d;
   struct stat st;
 
   if((fd = open(path, 0)) < 0){
@@ -41,32 +42,21 @@ ls(char *path)
     return;
   }
 
-  switch(st.type){
-  case T_FILE:
+  if(!ISDIR(st.type)){
     printf("%s %d %d %l\n", fmtname(path), st.type, st.ino, st.size);
-    break;
+    close(fd);
+    return;
+  }
 
-  case T_DIR:
-    if(strlen(path) + 1 + DIRSIZ + 1 > sizeof buf){
-      printf("ls: path too long\n");
-      break;
-    }
-    strcpy(buf, path);
-    p = buf+strlen(buf);
-    *p++ = '/';
-    while(read(fd, &de, sizeof(de)) == sizeof(de)){
-      if(de.inum == 0)
-        continue;
-      memmove(p, de.name, DIRSIZ);
-      p[DIRSIZ] = 0;
-      if(stat(buf, &st) < 0){
-        printf("ls: cannot stat %s\n", buf);
-        continue;
-      }
-      printf("%s %d %d %d\n", fmtname(buf), st.type, st.ino, st.size);
+  // a batch of entries, with type and size, per system call
+  while((n = getdents(fd, dents, sizeof(dents), DENT_STAT)) > 0){
+    for(i = 0; i < n; i += d->reclen){
+      d = (struct dirent_plus*)(dents + i);
+      printf("%s %d %d %l\n", fmtname((char*)(d + 1)), d->type, d->ino, d->size);
     }
-    break;
   }
+  if(n < 0)
+    fprintf(2, "ls: cannot read %s\n", path);
   close(fd);
 }
 
@@ -9,8 +9,9 @@ main(int argc, char *argv[])
     fprintf(2, "Usage: mv source dest\n");
     exit(1);
   }
-  if(link(argv[1], argv[2]) < 0)
+  if(rename(argv[1], argv[2]) < 0){
     fprintf(2, "can't move %s: failed\n", argv[1]);
-  unlink(argv[1]);
+    exit(1);
+  }
   exit(0);
 }
@@ -24,7 +24,7 @@ main(int argc, char* argv[])
     int n = strlen(rb);
     int p = strlen(rs);
 
-    char source[m + n];
+    char source[m + n + 1];
     for (int j = 0; j != n;j++)
     {
         source[j] = rb[j];
@@ -33,8 +33,9 @@ main(int argc, char* argv[])
     {
         source[n + i] = filename[i];
     }
+    source[n + m] = 0;
 
-    char dest[p + m];
+    char dest[p + m + 1];
     for (int i = 0;i != p;i++)
     {
         dest[i] = rs[i];
@@ -43,13 +44,13 @@ main(int argc, char* argv[])
     {
         dest[p + j] = filename[j];
     }
+    dest[p + m] = 0;
 
     fprintf(2, "source : %s\n", source);
     fprintf(2, "dest : %s\n", dest);
 
-    if (link(source, dest) < 0)
+    if (rename(source, dest) < 0)
         fprintf(2, "can't restore %s: failed\n", argv[1]);
-    unlink(source);
     // delete[] dest;
     exit(0);
 }
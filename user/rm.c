@@ -5,15 +5,19 @@
 int
 main(int argc, char *argv[])
 {
-  int i;
+  int i, first, r;
 
-  if(argc < 2){
-    fprintf(2, "Usage: rm files...\n");
+  first = 1;
+  if(argc > 1 && strcmp(argv[1], "-r") == 0)
+    first = 2;
+  if(argc <= first){
+    fprintf(2, "Usage: rm [-r] files...\n");
     exit(1);
   }
 
-  for(i = 1; i < argc; i++){
-    if(unlink(argv[i]) < 0){
+  for(i = first; i < argc; i++){
+    r = first == 2 ? rmtree(argv[i]) : unlink(argv[i]);
+    if(r < 0){
       fprintf(2, "rm: %s failed to delete\n", argv[i]);
       break;
     }
@@ -48,13 +48,14 @@ strcmp2(const char* p, const char* q)
   return 1;
 }
 
+#define DENTSIZE 1024
+
 void
 search(char* target, char* path)
 {
-  // fprintf(2, "call : remove %s\n", path);
-  char buf[512], * p;
-  int fd;
-  struct dirent de;
+  char buf[512], * p, * name, * dents;
+  int fd, n, i;
+  struct dirent_plus* d;
   struct stat st;
 
   if ((fd = open(path, 0)) < 0) {
@@ -70,57 +71,58 @@ search(char* target, char* path)
     return;
   }
 
-  switch (st.type) {
-
-  case T_FILE:
-  // path 是文件，递归的叶结点
-  if(strcmp2(target, fmtname(path)))
-  {
-    // fprintf(2,"%s %s\n",target,path);
-    fprintf(2, "target in : %s\n", path);
-  }
-  break;
-
-  case T_DIR:
-  // path 是文件夹
-  strcpy(buf, path);
-  p = buf + strlen(buf);
-  *p++ = '/';
-
-  int count = 0;
-
-  while (read(fd, &de, sizeof(de)) == sizeof(de)) {
-    count++;
-    if (count <= 2) continue;
-    // fprintf(2, "in while\n");
-    // if (de.inum == 0)
-    //   continue;
-    memmove(p, de.name, DIRSIZ);
-    p[DIRSIZ] = 0;
-    // if (stat(buf, &st) < 0) {
-    //   printf("ls: cannot stat %s\n", buf);
-    //   continue;
-    // }
-    // if (strcmp(fmtname(buf), ".") || strcmp(fmtname(buf), ".."))
-    //   continue;
-    // fprintf(2, buf);
-    // fprintf(2, "\n");
-    // fprintf(2, fmtname(buf));
-    // fprintf(2, "\n");
-
-    // fprintf(2, "recur call\n");
-    search(target,buf);
-  }
-  break;
+  if (ISDIR(st.type) && (dents = malloc(DENTSIZE)) != 0) {
+    // path 是文件夹，按批读取目录项，类型随目录项一起返回
+    strcpy(buf, path);
+    p = buf + strlen(buf);
+    *p++ = '/';
+    while ((n = getdents(fd, dents, DENTSIZE, DENT_STAT)) > 0) {
+      for (i = 0; i < n; i += d->reclen) {
+        d = (struct dirent_plus*)(dents + i);
+        name = (char*)(d + 1);
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+          continue;
+        if (p + d->namelen + 1 > buf + sizeof(buf))
+          continue;
+        memmove(p, name, d->namelen + 1);
+        if (ISDIR(d->type))
+          search(target, buf);
+        else if (strcmp2(target, name))
+          fprintf(2, "target in : %s\n", buf);
+      }
+    }
+    free(dents);
   }
   if (strcmp2(target, fmtname(path)))
   {
-    // fprintf(2, "%s %s\n", target, path);
     fprintf(2, "target in : %s\n", path);
   }
   close(fd);
 }
 
+// 通过内核的文件名索引查找：打印 path 之下名为 target 的所有路径。
+// Returns -1 if there is no index, or path is not absolute,
+// so that the caller walks the tree instead.
+int
+isearch(char* target, char* path)
+{
+  static char res[4096];
+  char* p;
+  int n, i, plen;
+
+  if (path[0] != '/' || (n = nsearch(target, res, sizeof(res))) < 0)
+    return -1;
+  plen = strlen(path);
+  while (plen > 1 && path[plen - 1] == '/')
+    plen--;
+  for (i = 0; i < n; i += strlen(p) + 1) {
+    p = res + i;
+    if (plen == 1 || (memcmp(p, path, plen) == 0 && (p[plen] == '/' || p[plen] == 0)))
+      fprintf(2, "target in : %s\n", p);
+  }
+  return 0;
+}
+
 int
 main(int argc, char* argv[])
 {
@@ -131,7 +133,7 @@ main(int argc, char* argv[])
     fprintf(2, "Note that [path] cannot be the root path.\n");
     exit(1);
   }
-  if(argc == 3)
+  if(argc == 3 && isearch(argv[1], argv[2]) < 0)
     search(argv[1], argv[2]);
   exit(0);
 }
\ No newline at end of file
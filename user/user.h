@@ -1,5 +1,7 @@
 struct stat;
 struct rtcdate;
+struct logstat;
+struct diskstat;
 
 // system calls
 int fork(void);
@@ -16,6 +18,12 @@ int mknod(const char*, short, short);
 int unlink(const char*);
 int fstat(int fd, struct stat*);
 int link(const char*, const char*);
+int rename(const char*, const char*);
+int rmtree(const char*);
+int fsync(int);
+int fdatasync(int);
+int getdents(int, void*, int, int);
+int nsearch(const char*, char*, int);
 int mkdir(const char*);
 int chdir(const char*);
 int dup(int);
@@ -26,6 +34,15 @@ int uptime(void);
 int logswitch(int);
 int isvndir(const char*);
 int mkvndir(const char*);
+int mkdxdir(const char*);
+int atimeswitch(int);
+int diskstat(struct diskstat*, int);
+int lseek(int, int, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int fallocate(int, int, int, int);
+int logstat(struct logstat*, int);
+int chattr(int, int, int);
 
 
 // ulib.c
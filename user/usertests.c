@@ -1553,6 +1553,457 @@ bigdir(char *s)
   }
 }
 
+// hash-indexed directory that has to split its leaves
+void
+bigdxdir(char *s)
+{
+  enum { N = 500 };
+  int i, fd;
+  char name[10];
+
+  if(mkdxdir("dx") != 0){
+    printf("%s: mkdxdir failed\n", s);
+    exit(1);
+  }
+  fd = open("dx/bd", O_CREATE);
+  if(fd < 0){
+    printf("%s: bigdxdir create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  for(i = 0; i < N; i++){
+    name[0] = 'd';
+    name[1] = 'x';
+    name[2] = '/';
+    name[3] = 'x';
+    name[4] = '0' + (i / 64);
+    name[5] = '0' + (i % 64);
+    name[6] = '\0';
+    if(link("dx/bd", name) != 0){
+      printf("%s: bigdxdir link(dx/bd, %s) failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("dx") == 0){
+    printf("%s: unlink non-empty dx succeeded\n", s);
+    exit(1);
+  }
+
+  unlink("dx/bd");
+  for(i = 0; i < N; i++){
+    name[4] = '0' + (i / 64);
+    name[5] = '0' + (i % 64);
+    if((fd = open(name, 0)) < 0){
+      printf("%s: bigdxdir open %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+    if(unlink(name) != 0){
+      printf("%s: bigdxdir unlink failed", s);
+      exit(1);
+    }
+  }
+  if(unlink("dx") != 0){
+    printf("%s: unlink empty dx failed\n", s);
+    exit(1);
+  }
+}
+
+// pread/pwrite use their own offset; lseek moves the file's.
+void
+preadwrite(char *s)
+{
+  int fd;
+  char buf[8];
+
+  unlink("pwfile");
+  fd = open("pwfile", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: create pwfile failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "abcdefgh", 8) != 8 || pwrite(fd, "XY", 2, 3) != 2){
+    printf("%s: pwrite failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "ij", 2) != 2){
+    printf("%s: write after pwrite failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, 4, 2) != 4 || memcmp(buf, "cXYf", 4) != 0){
+    printf("%s: pread returned wrong data\n", s);
+    exit(1);
+  }
+  if(lseek(fd, -3, SEEK_END) != 7 || read(fd, buf, 3) != 3 ||
+     memcmp(buf, "hij", 3) != 0){
+    printf("%s: lseek SEEK_END failed\n", s);
+    exit(1);
+  }
+  if(lseek(fd, -20, SEEK_CUR) >= 0 || lseek(fd, 1, SEEK_SET) != 1 ||
+     read(fd, buf, 1) != 1 || buf[0] != 'b'){
+    printf("%s: lseek SEEK_SET failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("pwfile");
+}
+
+// writing past the end of a file leaves a hole that reads as zeros
+void
+sparsefile(char *s)
+{
+  enum { GAP = 100*BSIZE };
+  int fd, i;
+  char buf[BSIZE];
+  struct stat st;
+
+  unlink("sparse");
+  fd = open("sparse", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: create sparse failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "x", 1) != 1 || lseek(fd, GAP, SEEK_SET) != GAP ||
+     write(fd, "y", 1) != 1){
+    printf("%s: write past end failed\n", s);
+    exit(1);
+  }
+  if(fstat(fd, &st) < 0 || st.size != GAP + 1){
+    printf("%s: sparse size wrong\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, BSIZE, GAP - BSIZE/2) != BSIZE/2 + 1 || buf[BSIZE/2] != 'y'){
+    printf("%s: read across hole failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < BSIZE/2; i++){
+    if(buf[i] != 0){
+      printf("%s: hole not zero\n", s);
+      exit(1);
+    }
+  }
+  if(lseek(fd, 0, SEEK_HOLE) != BSIZE || lseek(fd, BSIZE, SEEK_DATA) != GAP ||
+     lseek(fd, GAP, SEEK_HOLE) != GAP + 1 || lseek(fd, GAP + 1, SEEK_DATA) >= 0){
+    printf("%s: SEEK_DATA/SEEK_HOLE wrong\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("sparse");
+}
+
+// preallocated blocks read as zeros until written
+void
+prealloc(char *s)
+{
+  enum { N = 8 };
+  int fd, i;
+  char buf[BSIZE];
+  struct stat st;
+
+  unlink("prealloc");
+  fd = open("prealloc", O_CREATE | O_RDWR);
+  if(fd < 0 || chattr(fd, EXTENT_FL, 0) < 0){
+    printf("%s: create prealloc failed\n", s);
+    exit(1);
+  }
+  if(fallocate(fd, 0, 0, N*BSIZE) != 0 ||
+     fallocate(fd, FALLOC_FL_KEEP_SIZE, N*BSIZE, N*BSIZE) != 0){
+    printf("%s: fallocate failed\n", s);
+    exit(1);
+  }
+  if(fstat(fd, &st) < 0 || st.size != N*BSIZE){
+    printf("%s: fallocate size wrong\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "abc", 3, 3*BSIZE + 10) != 3){
+    printf("%s: write to preallocated block failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, BSIZE, 3*BSIZE) != BSIZE || memcmp(buf + 10, "abc", 3) != 0){
+    printf("%s: read back failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < BSIZE; i++){
+    if((i < 10 || i >= 13) && buf[i] != 0){
+      printf("%s: preallocated block not zero\n", s);
+      exit(1);
+    }
+  }
+  if(pwrite(fd, "z", 1, 2*N*BSIZE - 1) != 1 || pread(fd, buf, 1, N*BSIZE) != 1 ||
+     buf[0] != 0){
+    printf("%s: write past kept size failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("prealloc");
+}
+
+// data written to a compressed file reads back the same, after
+// overwrites across clusters and after truncation
+void
+comprtest(char *s)
+{
+  enum { N = 3*CSIZE, OFF = CSIZE - 100, LEN = 300 };
+  static char want[N], buf[N];
+  int fd, i, n;
+  uint x;
+
+  unlink("compr");
+  fd = open("compr", O_CREATE | O_RDWR);
+  if(fd < 0 || chattr(fd, COMPR_FL, 0) < 0){
+    printf("%s: create compr failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    want[i] = 'a' + (i / 100) % 26;
+  for(i = 0; i < N; i += n){
+    n = N - i < 1000 ? N - i : 1000;
+    if(write(fd, want + i, n) != n){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  if(pread(fd, buf, N, 0) != N || memcmp(buf, want, N) != 0){
+    printf("%s: read back failed\n", s);
+    exit(1);
+  }
+
+  // overwrite with data that does not compress, across a cluster
+  for(i = 0, x = 1; i < LEN; i++){
+    x = x * 1103515245 + 12345;
+    want[OFF + i] = x >> 16;
+  }
+  if(pwrite(fd, want + OFF, LEN, OFF) != LEN){
+    printf("%s: overwrite failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("compr", O_RDWR);
+  if(fd < 0 || read(fd, buf, N) != N || memcmp(buf, want, N) != 0){
+    printf("%s: read after overwrite failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("compr", O_RDWR | O_TRUNC);
+  if(fd < 0 || read(fd, buf, 1) != 0){
+    printf("%s: truncate failed\n", s);
+    exit(1);
+  }
+  if(write(fd, want, CSIZE + 10) != CSIZE + 10 ||
+     pread(fd, buf, N, 0) != CSIZE + 10 || memcmp(buf, want, CSIZE + 10) != 0){
+    printf("%s: rewrite after truncate failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("compr");
+}
+
+void
+renametest(char *s)
+{
+  int fd;
+  char buf[4];
+
+  if(mkdir("rna") != 0 || mkdir("rnb") != 0){
+    printf("%s: mkdir failed\n", s);
+    exit(1);
+  }
+  fd = open("rna/f", O_CREATE | O_RDWR);
+  if(fd < 0 || write(fd, "abc", 3) != 3){
+    printf("%s: create rna/f failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  close(open("rnb/g", O_CREATE | O_RDWR));
+
+  if(rename("rna/f", "rna/f2") != 0 || rename("rna/f2", "rnb/g") != 0){
+    printf("%s: rename file failed\n", s);
+    exit(1);
+  }
+  if(open("rna/f", 0) >= 0 || open("rna/f2", 0) >= 0){
+    printf("%s: old name still there\n", s);
+    exit(1);
+  }
+  fd = open("rnb/g", 0);
+  if(fd < 0 || read(fd, buf, 3) != 3 || memcmp(buf, "abc", 3) != 0){
+    printf("%s: replaced file has wrong data\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(rename("rna", "rnb/d") != 0 || chdir("rnb/d") != 0){
+    printf("%s: rename dir failed\n", s);
+    exit(1);
+  }
+  if(chdir("../..") != 0 || open("rnb/g", 0) < 0){
+    printf("%s: .. of moved dir wrong\n", s);
+    exit(1);
+  }
+  if(rename("rnb", "rnb/d/x") == 0){
+    printf("%s: moved dir below itself\n", s);
+    exit(1);
+  }
+  close(open("rnb/d/f", O_CREATE | O_RDWR));
+  if(rename("rnb/d/f", "rnb") == 0){
+    printf("%s: replaced an ancestor\n", s);
+    exit(1);
+  }
+
+  if(unlink("rnb/d/f") != 0 ||
+     unlink("rnb/g") != 0 || unlink("rnb/d") != 0 || unlink("rnb") != 0){
+    printf("%s: cleanup failed\n", s);
+    exit(1);
+  }
+}
+
+// rmtree removes a whole tree and counts what it removed
+void
+rmtreetest(char *s)
+{
+  enum { N = 10 };
+  int i;
+  char name[16];
+
+  if(mkdir("rt") != 0 || mkdir("rt/a") != 0 || mkdir("rt/a/b") != 0 ||
+     mkdir("rt/e") != 0){
+    printf("%s: mkdir failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    strcpy(name, "rt/a/b/f0");
+    name[8] = '0' + i;
+    close(open(name, O_CREATE | O_RDWR));
+  }
+  if(rmtree("rt/.") >= 0){
+    printf("%s: rmtree of . succeeded\n", s);
+    exit(1);
+  }
+  if(rmtree("rt") != N + 4){
+    printf("%s: rmtree count wrong\n", s);
+    exit(1);
+  }
+  if(open("rt", 0) >= 0){
+    printf("%s: rt still there\n", s);
+    exit(1);
+  }
+}
+
+void
+fsynctest(char *s)
+{
+  int fd, p[2];
+  char buf[8];
+
+  fd = open("fsyncf", O_CREATE | O_RDWR | O_SYNC);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "abcdefgh", 8) != 8 || fsync(fd) != 0 || fdatasync(fd) != 0){
+    printf("%s: write or fsync failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("fsyncf", O_RDONLY);
+  if(read(fd, buf, 8) != 8 || memcmp(buf, "abcdefgh", 8) != 0){
+    printf("%s: wrong data\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("fsyncf");
+
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(fsync(p[0]) >= 0){
+    printf("%s: fsync of a pipe succeeded\n", s);
+    exit(1);
+  }
+  close(p[0]);
+  close(p[1]);
+}
+
+void
+getdentstest(char *s)
+{
+  enum { N = 20 };
+  char dents[128], name[16];
+  struct dirent_plus *d;
+  int fd, n, i, count, files;
+
+  if(mkvndir("gd") != 0){
+    printf("%s: mkvndir failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    strcpy(name, "gd/f00");
+    name[4] = '0' + i / 10;
+    name[5] = '0' + i % 10;
+    fd = open(name, O_CREATE | O_RDWR);
+    write(fd, "x", 1);
+    close(fd);
+  }
+  fd = open("gd", O_RDONLY);
+  count = files = 0;
+  // a small buffer, so that it takes several calls
+  while((n = getdents(fd, dents, sizeof(dents), DENT_STAT)) > 0){
+    for(i = 0; i < n; i += d->reclen){
+      d = (struct dirent_plus*)(dents + i);
+      count++;
+      if(d->type == T_FILE && d->size == 1 && d->namelen == 3)
+        files++;
+    }
+  }
+  close(fd);
+  if(n != 0 || count != N + 2 || files != N){
+    printf("%s: getdents saw %d entries, %d files\n", s, count, files);
+    exit(1);
+  }
+  if(getdents(0, dents, sizeof(dents), 0) >= 0){
+    printf("%s: getdents of a non-directory succeeded\n", s);
+    exit(1);
+  }
+  rmtree("gd");
+}
+
+void
+nsearchtest(char *s)
+{
+  char res[256];
+  int n;
+
+  if(nsearch("nsfile1", res, sizeof(res)) < 0)
+    return;   // no filename index on this file system
+  if(mkdir("nsd") != 0){
+    printf("%s: mkdir failed\n", s);
+    exit(1);
+  }
+  close(open("nsd/nsfile1", O_CREATE | O_RDWR));
+  n = nsearch("nsfile1", res, sizeof(res));
+  if(n != 14 || strcmp(res, "/nsd/nsfile1") != 0){
+    printf("%s: nsearch after create returned %d\n", s, n);
+    exit(1);
+  }
+  if(rename("nsd/nsfile1", "nsd/nsfile2") != 0){
+    printf("%s: rename failed\n", s);
+    exit(1);
+  }
+  if(nsearch("nsfile1", res, sizeof(res)) != 0 ||
+     nsearch("nsfile2", res, sizeof(res)) != 14){
+    printf("%s: nsearch after rename\n", s);
+    exit(1);
+  }
+  unlink("nsd/nsfile2");
+  if(nsearch("nsfile2", res, sizeof(res)) != 0){
+    printf("%s: nsearch after unlink\n", s);
+    exit(1);
+  }
+  unlink("nsd");
+}
+
 void
 subdir(char *s)
 {
@@ -2010,7 +2461,7 @@ iref(char *s)
 {
   int i, fd;
 
-  for(i = 0; i < NINODE + 1; i++){
+  for(i = 0; i < NICACHE + 1; i++){
     if(mkdir("irefd") != 0){
       printf("%s: mkdir irefd failed\n", s);
       exit(1);
@@ -2032,7 +2483,7 @@ iref(char *s)
   }
 
   // clean up
-  for(i = 0; i < NINODE + 1; i++){
+  for(i = 0; i < NICACHE + 1; i++){
     chdir("..");
     unlink("irefd");
   }
@@ -2881,6 +3332,16 @@ main(int argc, char *argv[])
     {iref, "iref"},
     {forktest, "forktest"},
     {bigdir, "bigdir"}, // slow
+    {bigdxdir, "bigdxdir"}, // slow
+    {preadwrite, "preadwrite"},
+    {sparsefile, "sparsefile"},
+    {prealloc, "prealloc"},
+    {comprtest, "comprtest"},
+    {renametest, "renametest"},
+    {rmtreetest, "rmtreetest"},
+    {fsynctest, "fsynctest"},
+    {getdentstest, "getdentstest"},
+    {nsearchtest, "nsearchtest"},
     { 0, 0},
   };
 
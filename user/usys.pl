@@ -39,3 +39,18 @@ entry("uptime");
 entry("logswitch");
 entry("isvndir");
 entry("mkvndir");
+entry("logstat");
+entry("chattr");
+entry("mkdxdir");
+entry("atimeswitch");
+entry("diskstat");
+entry("lseek");
+entry("pread");
+entry("pwrite");
+entry("fallocate");
+entry("rename");
+entry("rmtree");
+entry("fsync");
+entry("fdatasync");
+entry("getdents");
+entry("nsearch");